@@ -0,0 +1,125 @@
+#include "DesignGenerator.h"
+#include <algorithm>
+#include <fmt/core.h>
+#include <fstream>
+
+DesignGenerator::DesignGenerator(design_params params) : params(params) {
+  this->params.depth = std::max<size_t>(this->params.depth, 1);
+  this->params.struct_width = std::max<size_t>(this->params.struct_width, 1);
+}
+
+std::string DesignGenerator::getModuleName(size_t index) {
+  return fmt::format("mod_{:06}", index);
+}
+
+std::vector<DesignGenerator::source_file> DesignGenerator::generate() const {
+  std::vector<source_file> files;
+  files.reserve(params.modules + 2);
+  files.push_back({fmt::format("{}.sv", package_name), generatePackage()});
+  for (size_t i = 0; i < params.modules; i++)
+    files.push_back({getModuleName(i) + ".sv", generateModule(i)});
+  files.push_back({fmt::format("{}.sv", top_name), generateTop()});
+  return files;
+}
+
+std::vector<fs::path> DesignGenerator::write(const fs::path &dir) const {
+  fs::create_directories(dir);
+  std::vector<fs::path> paths;
+  for (auto &file : generate()) {
+    auto path = dir / file.name;
+    std::ofstream out(path, std::ios::binary);
+    out << file.contents;
+    paths.push_back(path);
+  }
+  return paths;
+}
+
+std::string DesignGenerator::generatePackage() const {
+  std::string res = fmt::format("package {};\n", package_name);
+  for (size_t i = 0; i < params.package_items; i++) {
+    if (i % 2 == 0)
+      res += fmt::format("  parameter int P{} = {};\n", i, i);
+    else
+      res += fmt::format("  typedef logic [{}:0] vec_{}_t;\n", i % 64, i);
+  }
+
+  res += "\n  typedef struct packed {\n"
+         "    logic [7:0] data;\n"
+         "    logic [3:0] tag;\n"
+         "    logic valid;\n"
+         "  } inner_t;\n\n"
+         "  typedef struct packed {\n";
+  for (size_t i = 0; i < params.struct_width; i++)
+    res += fmt::format("    inner_t f{};\n", i);
+  res += "  } wide_t;\nendpackage\n";
+  return res;
+}
+
+// Each module passes the struct to the next one of its chain, the last one
+// of the chain sends it back
+std::string DesignGenerator::generateModule(size_t index) const {
+  std::string res = fmt::format("module {}\n"
+                                "  import {}::*;\n"
+                                "#(\n"
+                                "    parameter int W = 8\n"
+                                ") (\n"
+                                "    input logic clk,\n"
+                                "    input wide_t in_data,\n"
+                                "    output wide_t out_data\n"
+                                ");\n"
+                                "  wide_t data_q;\n"
+                                "  logic [W-1:0] counter;\n\n"
+                                "  always_ff @(posedge clk) begin\n"
+                                "    data_q <= in_data;\n"
+                                "    counter <= counter + 1;\n"
+                                "    {}\n"
+                                "  end\n\n",
+                                getModuleName(index), package_name,
+                                completion_marker);
+
+  if (params.warnings)
+    res += fmt::format("  $warning(\"{} is generated\");\n\n",
+                       getModuleName(index));
+
+  res += fmt::format("  for (genvar g = 0; g < {}; g++) begin : gen_lanes\n"
+                     "    logic [W-1:0] lane;\n"
+                     "    assign lane = counter + g;\n"
+                     "  end\n\n",
+                     params.generate_count);
+
+  bool last = (index + 1) % params.depth == 0 || index + 1 == params.modules;
+  if (last)
+    res += "  assign out_data = data_q;\n";
+  else
+    res += fmt::format("  {} #(.W(W)) u_child (\n"
+                       "      .clk(clk),\n"
+                       "      .in_data(data_q),\n"
+                       "      .out_data(out_data)\n"
+                       "  );\n",
+                       getModuleName(index + 1));
+  res += "endmodule\n";
+  return res;
+}
+
+// The top instantiates the first module of each chain
+std::string DesignGenerator::generateTop() const {
+  size_t chains = (params.modules + params.depth - 1) / params.depth;
+  std::string res = fmt::format("module {}\n"
+                                "  import {}::*;\n"
+                                "(\n"
+                                "    input logic clk,\n"
+                                "    input wide_t in_data,\n"
+                                "    output wide_t out_data[{}]\n"
+                                ");\n",
+                                top_name, package_name,
+                                std::max<size_t>(chains, 1));
+  for (size_t i = 0; i < chains; i++)
+    res += fmt::format("  {} u_chain_{} (\n"
+                       "      .clk(clk),\n"
+                       "      .in_data(in_data),\n"
+                       "      .out_data(out_data[{}])\n"
+                       "  );\n",
+                       getModuleName(i * params.depth), i, i);
+  res += "endmodule\n";
+  return res;
+}
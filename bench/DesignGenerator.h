@@ -0,0 +1,55 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Shape of a generated design
+struct design_params {
+  // One module per file
+  size_t modules = 10;
+  // Modules instantiating each other in a chain, under the top
+  size_t depth = 4;
+  // Parameters and typedefs of the package
+  size_t package_items = 100;
+  // Members of the struct carried through the hierarchy
+  size_t struct_width = 16;
+  // Iterations of the generate loop of each module
+  size_t generate_count = 8;
+  // A width mismatch in each module, so there are diagnostics to report
+  bool warnings = true;
+};
+
+// Writes synthetic SystemVerilog designs, to measure how the server scales.
+// The design is a package with a wide struct, and chains of modules passing
+// that struct down the hierarchy. The output only depends on the parameters.
+class DesignGenerator {
+public:
+  struct source_file {
+    std::string name;
+    std::string contents;
+  };
+
+  explicit DesignGenerator(design_params params);
+
+  // The package comes first, then the modules and the top
+  std::vector<source_file> generate() const;
+  // Write the files, returns their paths
+  std::vector<fs::path> write(const fs::path &dir) const;
+
+  static std::string getModuleName(size_t index);
+  static constexpr const char *package_name = "bench_pkg";
+  static constexpr const char *top_name = "bench_top";
+  // Line of every module inside its clocked block, where the completions
+  // are measured
+  static constexpr const char *completion_marker = "// complete here";
+
+private:
+  std::string generatePackage() const;
+  std::string generateModule(size_t index) const;
+  std::string generateTop() const;
+
+  design_params params;
+};
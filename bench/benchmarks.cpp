@@ -0,0 +1,191 @@
+// Steps of the server measured on generated designs, from 10 to 100k files.
+// The designs are written to the temporary directory on first use. Pick the
+// steps and sizes with --benchmark_filter, the largest ones take minutes.
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <slang/diagnostics/DiagnosticEngine.h>
+#include <string>
+#include <vector>
+
+#include "CompletionCatalog.h"
+#include "CompletionHandler.h"
+#include "DesignGenerator.h"
+#include "DiagnosticParser.h"
+#include "NodeVisitor.h"
+#include "ProjectSources.h"
+#include "ServerStats.h"
+#include "dummyLog.h"
+
+static constexpr int64_t min_modules = 10;
+static constexpr int64_t max_modules = 100000;
+
+// Paths of the design of each size, the package first
+static const std::vector<fs::path> &getDesign(size_t modules) {
+  static std::map<size_t, std::vector<fs::path>> designs;
+  auto &res = designs[modules];
+  if (res.empty()) {
+    design_params params;
+    params.modules = modules;
+    auto dir =
+        fs::temp_directory_path() / fmt::format("sver-bench-{}", modules);
+    fs::remove_all(dir);
+    res = DesignGenerator(params).write(dir);
+  }
+  return res;
+}
+
+// All the files of a design, loaded as if opened by the user
+struct project {
+  explicit project(size_t modules) : sources(stats) {
+    auto &paths = getDesign(modules);
+    sources.setRootPath(paths.front().parent_path());
+    for (auto &path : paths) {
+      FileId file = sources.getFiles().getId(path);
+      sources.addFile(file);
+      files.push_back(file);
+    }
+  }
+
+  std::shared_ptr<slang::Compilation> compile() { return sources.compile(sm); }
+
+  ServerStats stats;
+  ProjectSources sources;
+  std::shared_ptr<slang::SourceManager> sm;
+  std::vector<FileId> files;
+};
+
+// A compiled and indexed project, as the requests see it
+struct analyzed_project : project {
+  explicit analyzed_project(size_t modules) : project(modules) {
+    compilation = compile();
+    nv = std::make_shared<NodeVisitor>(sm, sources.getFiles());
+    compilation->getRoot().visit(*nv);
+    nv->finish();
+    catalog = std::make_shared<CompletionCatalog>(*nv, files);
+  }
+
+  // Position of the completions, in the clocked block of the first module
+  uint64_t getCompletionPosition() const {
+    std::ifstream in(sources.getFiles().getPath(getCompletionFile()));
+    std::string line;
+    for (size_t i = 0; std::getline(in, line); i++) {
+      auto column = line.find(DesignGenerator::completion_marker);
+      if (column != std::string::npos)
+        return NodeVisitor::makePosition(i, column);
+    }
+    return 0;
+  }
+  FileId getCompletionFile() const { return files[1]; }
+
+  std::shared_ptr<slang::Compilation> compilation;
+  std::shared_ptr<NodeVisitor> nv;
+  std::shared_ptr<CompletionCatalog> catalog;
+};
+
+// Parse everything and resolve the libraries, from an empty cache
+static void BM_Compile(benchmark::State &state) {
+  size_t modules = state.range(0);
+  getDesign(modules);
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto p = std::make_unique<project>(modules);
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(p->compile());
+    state.PauseTiming();
+    p.reset();
+    state.ResumeTiming();
+  }
+  state.SetComplexityN(modules);
+}
+
+// Compile again without changes, all the trees come from the cache
+static void BM_Recompile(benchmark::State &state) {
+  size_t modules = state.range(0);
+  project p(modules);
+  p.compile();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(p.compile());
+  state.SetComplexityN(modules);
+}
+
+static void BM_Elaborate(benchmark::State &state) {
+  size_t modules = state.range(0);
+  project p(modules);
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto compilation = p.compile();
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(compilation->getAllDiagnostics().size());
+  }
+  state.SetComplexityN(modules);
+}
+
+static void BM_NodeVisitor(benchmark::State &state) {
+  size_t modules = state.range(0);
+  analyzed_project p(modules);
+  for (auto _ : state) {
+    NodeVisitor nv(p.sm, p.sources.getFiles());
+    p.compilation->getRoot().visit(nv);
+    nv.finish();
+  }
+  state.SetComplexityN(modules);
+}
+
+// Conversion of the diagnostics of a compilation to the LSP ones
+static void BM_DiagnosticReport(benchmark::State &state) {
+  size_t modules = state.range(0);
+  analyzed_project p(modules);
+  DummyLog log;
+  auto &diags = p.compilation->getAllDiagnostics();
+  for (auto _ : state) {
+    slang::DiagnosticEngine engine(*p.sm);
+    engine.setDefaultWarnings();
+    auto parser = std::make_shared<DiagnosticParser>(log, p.sources);
+    engine.addClient(parser);
+    for (auto &diag : diags)
+      engine.issue(diag);
+    benchmark::DoNotOptimize(parser->getDiagnostics().size());
+  }
+  state.counters["diagnostics"] = diags.size();
+  state.SetComplexityN(modules);
+}
+
+// The line is the text before the cursor, as cut by the server
+static void runCompletion(benchmark::State &state, const std::string &line) {
+  size_t modules = state.range(0);
+  analyzed_project p(modules);
+  auto position = p.getCompletionPosition();
+  for (auto _ : state) {
+    CompletionHandler completer(p.nv, p.catalog);
+    td_completion::response resp;
+    completer.complete(line, p.getCompletionFile(), position, resp, 0);
+    benchmark::DoNotOptimize(resp.result.items.size());
+  }
+  state.SetComplexityN(modules);
+}
+
+static void BM_CompleteIdentifier(benchmark::State &state) {
+  runCompletion(state, "cou");
+}
+
+// Through complete_struct, down to the members of the inner struct
+static void BM_CompleteStruct(benchmark::State &state) {
+  runCompletion(state, "data_q.f3.");
+}
+
+static void sizes(benchmark::internal::Benchmark *b) {
+  b->RangeMultiplier(10)->Range(min_modules, max_modules)->Complexity();
+}
+
+BENCHMARK(BM_Compile)->Apply(sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Recompile)->Apply(sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Elaborate)->Apply(sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_NodeVisitor)->Apply(sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_DiagnosticReport)->Apply(sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_CompleteIdentifier)->Apply(sizes)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_CompleteStruct)->Apply(sizes)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_MAIN();
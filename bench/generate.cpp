@@ -0,0 +1,52 @@
+// Writes a generated design, to try the server on a large project
+#include <boost/program_options.hpp>
+#include <iostream>
+
+#include "DesignGenerator.h"
+
+namespace po = boost::program_options;
+
+int main(int argc, char *argv[]) {
+  design_params params;
+  po::options_description desc("Usage: sver-gen-design [options] directory\n"
+                               "Allowed options");
+  desc.add_options()("help", "produce help message")(
+      "modules", po::value<size_t>(&params.modules)->default_value(100),
+      "number of modules, one per file")(
+      "depth", po::value<size_t>(&params.depth)->default_value(4),
+      "modules in each chain of instances")(
+      "package-items",
+      po::value<size_t>(&params.package_items)->default_value(100),
+      "parameters and typedefs in the package")(
+      "struct-width",
+      po::value<size_t>(&params.struct_width)->default_value(16),
+      "members of the struct passed through the hierarchy")(
+      "generate-count",
+      po::value<size_t>(&params.generate_count)->default_value(8),
+      "iterations of the generate loop of each module")(
+      "no-warnings", "do not add a warning to each module");
+  po::options_description hidden;
+  hidden.add_options()("directory", po::value<std::string>());
+  po::options_description all;
+  all.add(desc).add(hidden);
+  po::positional_options_description positional;
+  positional.add("directory", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv)
+                .options(all)
+                .positional(positional)
+                .run(),
+            vm);
+  po::notify(vm);
+
+  if (vm.count("help") || !vm.count("directory")) {
+    std::cout << desc << "\n";
+    return 1;
+  }
+  params.warnings = !vm.count("no-warnings");
+
+  auto paths = DesignGenerator(params).write(vm["directory"].as<std::string>());
+  std::cout << "Wrote " << paths.size() << " files" << std::endl;
+  return 0;
+}
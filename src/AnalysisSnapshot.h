@@ -0,0 +1,25 @@
+#pragma once
+#include "CompletionCatalog.h"
+#include "NodeVisitor.h"
+#include "ReferenceIndex.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <slang/compilation/Compilation.h>
+#include <slang/text/SourceManager.h>
+
+// Result of a finished compilation. It is never modified after being
+// published, so requests can use it while the next compilation runs.
+// The compilation is fully elaborated before publishing, and the
+// SourceManager keeps alive the buffers the visitor symbols point to.
+struct AnalysisSnapshot {
+  uint64_t version;
+  std::shared_ptr<slang::SourceManager> sm;
+  std::shared_ptr<slang::Compilation> compilation;
+  std::shared_ptr<const NodeVisitor> nv;
+  std::shared_ptr<const CompletionCatalog> catalog;
+  std::shared_ptr<const ReferenceIndex> references;
+  // Document revision of the compiled files, the ones read from disk are
+  // left out
+  std::map<FileId, uint64_t> revisions;
+};
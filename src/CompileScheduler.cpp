@@ -0,0 +1,74 @@
+#include "CompileScheduler.h"
+
+CompileScheduler::CompileScheduler(compile_fn fn,
+                                   std::chrono::milliseconds delay)
+    : compile(fn), delay(delay), generation(0), pending(false),
+      stopping(false) {
+  worker = std::thread([this]() { run(); });
+}
+
+CompileScheduler::~CompileScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cv.notify_all();
+  worker.join();
+}
+
+void CompileScheduler::schedule() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    // Any running compilation is now outdated
+    generation++;
+    pending = true;
+    deadline = std::chrono::steady_clock::now() + delay;
+  }
+  cv.notify_all();
+}
+
+void CompileScheduler::scheduleNow() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    generation++;
+    pending = true;
+    deadline = std::chrono::steady_clock::now();
+  }
+  cv.notify_all();
+}
+
+void CompileScheduler::invalidate() { generation++; }
+
+void CompileScheduler::setDelay(std::chrono::milliseconds new_delay) {
+  std::lock_guard<std::mutex> lock(mutex);
+  delay = new_delay;
+}
+
+bool CompileScheduler::isStale(uint64_t gen) const {
+  return generation.load() != gen;
+}
+
+uint64_t CompileScheduler::getGeneration() const { return generation.load(); }
+
+void CompileScheduler::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    cv.wait(lock, [this]() { return pending || stopping; });
+    if (stopping)
+      return;
+
+    // Wait until no changes arrive during the debounce window.
+    // Every schedule() moves the deadline forward.
+    while (!stopping && std::chrono::steady_clock::now() < deadline)
+      cv.wait_until(lock, deadline);
+    if (stopping)
+      return;
+
+    pending = false;
+    uint64_t gen = generation.load();
+
+    lock.unlock();
+    compile(gen);
+    lock.lock();
+  }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Runs the compilations on a dedicated thread. Requests arriving inside the
+// debounce window are merged into a single compilation, and the generation
+// passed to the callback allows it to detect that its inputs went stale.
+class CompileScheduler {
+public:
+  typedef std::function<void(uint64_t generation)> compile_fn;
+
+  CompileScheduler(compile_fn fn,
+                   std::chrono::milliseconds delay = default_delay);
+  ~CompileScheduler();
+
+  // Notify that the compilation inputs changed
+  void schedule();
+  // Same, but compile without waiting for the debounce window
+  void scheduleNow();
+  // Abandon the running compilation without scheduling a new one
+  void invalidate();
+  void setDelay(std::chrono::milliseconds new_delay);
+  // Check if the inputs changed after the given generation was started
+  bool isStale(uint64_t gen) const;
+  uint64_t getGeneration() const;
+
+  static constexpr std::chrono::milliseconds default_delay{200};
+
+private:
+  void run();
+
+  compile_fn compile;
+  std::chrono::milliseconds delay;
+  std::chrono::steady_clock::time_point deadline;
+  std::atomic<uint64_t> generation;
+  bool pending, stopping;
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::thread worker;
+};
@@ -0,0 +1,372 @@
+#include "CompletionCatalog.h"
+#include <array>
+#include <optional>
+#include <string_view>
+
+static constexpr std::array<std::string_view, 102> verilog_keywords = {
+    "always",       "end",        "ifnone",   "or",        "rpmos",
+    "tranif1",      "and",        "endcase",  "initial",   "output",
+    "rtran",        "tri",        "assign",   "endmodule", "inout",
+    "parameter",    "rtranif0",   "tri0",     "begin",     "endfunction",
+    "input",        "pmos",       "rtranif1", "tri1",      "buf",
+    "endprimitive", "integer",    "posedge",  "scalared",  "triand",
+    "bufif0",       "endspecify", "join",     "primitive", "small",
+    "trior",        "bufif1",     "endtable", "large",     "pull0",
+    "specify",      "trireg",     "case",     "endtask",   "macromodule",
+    "pull1",        "specparam",  "vectored", "casex",     "event",
+    "medium",       "pullup",     "strong0",  "wait",      "casez",
+    "for",          "module",     "pulldown", "strong1",   "wand",
+    "cmos",         "force",      "nand",     "rcmos",     "supply0",
+    "weak0",        "deassign",   "forever",  "negedge",   "real",
+    "supply1",      "weak1",      "default",  "for",       "nmos",
+    "realtime",     "table",      "while",    "defparam",  "function",
+    "nor",          "reg",        "task",     "wire",      "disable",
+    "highz0",       "not",        "release",  "time",      "wor",
+    "edge",         "highz1",     "notif0",   "repeat",    "tran",
+    "xnor",         "else",       "if",       "notif1",    "rnmos",
+    "tranif0",      "xor"};
+
+static constexpr std::array<std::string_view, 96> systemverilog_keywords = {
+    "alias",         "always_comb",  "always_ff",    "always_latch",
+    "assert",        "assume",       "before",       "bind",
+    "bins",          "binsof",       "bit",          "break",
+    "byte",          "chandle",      "class",        "clocking",
+    "const",         "constraint",   "context",      "continue",
+    "cover",         "covergroup",   "coverpoint",   "cross",
+    "dist",          "do",           "endclass",     "endclocking",
+    "endgroup",      "endinterface", "endpackage",   "endprogram",
+    "endproperty",   "endsequence",  "enum",         "expect",
+    "export",        "extends",      "extern",       "final",
+    "first_match",   "foreach",      "forkjoin",     "iff",
+    "ignore_bins",   "illegal_bins", "import",       "inside",
+    "int",           "interface",    "intersect",    "join_any",
+    "join_none",     "local",        "logic",        "longint",
+    "matches",       "modport",      "new",          "null",
+    "package",       "packed",       "priority",     "program",
+    "property",      "protected",    "pure",         "rand",
+    "randc",         "randcase",     "randsequence", "ref",
+    "return",        "sequence",     "shortint",     "shortreal",
+    "solve",         "static",       "string",       "struct",
+    "super",         "tagged",       "this",         "throughout",
+    "timeprecision", "type",         "typedef",      "union",
+    "unique",        "var",          "virtual",      "void",
+    "wait_order",    "wildcard",     "with",         "within",
+};
+
+static constexpr std::array<std::string_view, 200> verilog_system_functions = {
+    "$finish",
+    "$stop",
+    "$exit",
+    "$realtime",
+    "$stime",
+    "$time",
+    "$printtimescale",
+    "$timeformat",
+    "$bitstoreal",
+    "$realtobits",
+    "$bitstoshortreal",
+    "$shortrealtobits",
+    "$itor",
+    "$rtoi",
+    "$signed",
+    "$unsigned",
+    "$cast",
+    "$bits",
+    "$isunbounded",
+    "$typename",
+    "$unpacked_dimensions",
+    "$dimensions",
+    "$left",
+    "$right",
+    "$low",
+    "$high",
+    "$increment",
+    "$size",
+    "$clog2",
+    "$asin",
+    "$ln",
+    "$acos",
+    "$log10",
+    "$atan",
+    "$exp",
+    "$atan2",
+    "$sqrt",
+    "$hypot",
+    "$pow",
+    "$sinh",
+    "$floor",
+    "$cosh",
+    "$ceil",
+    "$tanh",
+    "$sin",
+    "$asinh",
+    "$cos",
+    "$acosh",
+    "$tan",
+    "$atanh",
+    "$countbits",
+    "$countones",
+    "$onehot",
+    "$onehot0",
+    "$isunknown",
+    "$fatal",
+    "$error",
+    "$warning",
+    "$info",
+    "$fatal",
+    "$error",
+    "$warning",
+    "$info",
+    "$asserton",
+    "$assertoff",
+    "$assertkill",
+    "$assertcontrol",
+    "$assertpasson",
+    "$assertpassoff",
+    "$assertfailon",
+    "$assertfailoff",
+    "$assertnonvacuouson",
+    "$assertvacuousoff",
+    "$sampled",
+    "$rose",
+    "$fell",
+    "$stable",
+    "$changed",
+    "$past",
+    "$past_gclk",
+    "$rose_gclk",
+    "$fell_gclk",
+    "$stable_gclk",
+    "$changed_gclk",
+    "$future_gclk",
+    "$rising_gclk",
+    "$falling_gclk",
+    "$steady_gclk",
+    "$changing_gclk",
+    "$coverage_control",
+    "$coverage_get_max",
+    "$coverage_get",
+    "$coverage_merge",
+    "$coverage_save",
+    "$get_coverage",
+    "$set_coverage_db_name",
+    "$load_coverage_db",
+    "$random",
+    "$dist_chi_square",
+    "$dist_erlang",
+    "$dist_exponential",
+    "$dist_normal",
+    "$dist_poisson",
+    "$dist_t",
+    "$dist_uniform",
+    "$q_initialize",
+    "$q_add",
+    "$q_remove",
+    "$q_full",
+    "$q_exam",
+    "$async$and$array",
+    "$async$and$plane",
+    "$async$nand$array",
+    "$async$nand$plane",
+    "$async$or$array",
+    "$async$or$plane",
+    "$async$nor$array",
+    "$async$nor$plane",
+    "$sync$and$array",
+    "$sync$and$plane",
+    "$sync$nand$array",
+    "$sync$nand$plane",
+    "$sync$or$array",
+    "$sync$or$plane",
+    "$sync$nor$array",
+    "$sync$nor$plane",
+    "$system",
+    "$display",
+    "$write",
+    "$displayb",
+    "$writeb",
+    "$displayh",
+    "$writeh",
+    "$displayo",
+    "$writeo",
+    "$strobe",
+    "$monitor",
+    "$strobeb",
+    "$monitorb",
+    "$strobeh",
+    "$monitorh",
+    "$strobeo",
+    "$monitoro",
+    "$monitoroff",
+    "$monitoron",
+    "$fclose",
+    "$fopen",
+    "$fdisplay",
+    "$fwrite",
+    "$fdisplayb",
+    "$fwriteb",
+    "$fdisplayh",
+    "$fwriteh",
+    "$fdisplayo",
+    "$fwriteo",
+    "$fstrobe",
+    "$fmonitor",
+    "$fstrobeb",
+    "$fmonitorb",
+    "$fstrobeh",
+    "$fmonitorh",
+    "$fstrobeo",
+    "$fmonitoro",
+    "$swrite",
+    "$sformat",
+    "$swriteb",
+    "$sformatf",
+    "$swriteh",
+    "$fgetc",
+    "$swriteo",
+    "$ungetc",
+    "$fscanf",
+    "$fgets",
+    "$fread",
+    "$sscanf",
+    "$fseek",
+    "$rewind",
+    "$fflush",
+    "$ftell",
+    "$feof",
+    "$ferror",
+    "$readmemb",
+    "$readmemh",
+    "$writememb",
+    "$writememh",
+    "$test$plusargs",
+    "$value$plusargs",
+    "$dumpfile",
+    "$dumpvars",
+    "$dumpoff",
+    "$dumpon",
+    "$dumpall",
+    "$dumplimit",
+    "$dumpflush",
+    "$dumpports",
+    "$dumpportsoff",
+    "$dumpportson",
+    "$dumpportsall",
+    "$dumpportslimit",
+    "$dumpportsflush",
+};
+
+CompletionCatalog::CompletionCatalog(const NodeVisitor &nv,
+                                     const std::vector<FileId> &files) {
+  for (auto file : files) {
+    auto &catalog = file_items[file];
+    auto symbols = nv.getFileSymbols(file);
+    if (symbols != nullptr) {
+      for (auto &sym : *symbols) {
+        catalog.items.push_back(makeItem(sym));
+        catalog.scopes.push_back(sym.scope);
+      }
+    }
+
+    // Types declared in the scopes of the file
+    for (auto scope : nv.getFileScopes(file)) {
+      for (auto tname : nv.getScopeTypes(scope)) {
+        lsCompletionItem it;
+        it.label = std::string(tname);
+        it.documentation = std::make_pair(std::string(scope), std::nullopt);
+        it.kind = lsCompletionItemKind::Reference;
+        catalog.items.push_back(std::move(it));
+        catalog.scopes.push_back(NodeVisitor::no_scope);
+      }
+    }
+    catalog.items.shrink_to_fit();
+    catalog.scopes.shrink_to_fit();
+  }
+
+  // Symbols of all the loaded packages, by package
+  slang::flat_hash_set<FileId> package_files;
+  for (auto pkg : nv.getPackageList()) {
+    // Files with several packages are listed once per package
+    if (!package_files.insert(pkg).second)
+      continue;
+    auto symbols = nv.getFileSymbols(pkg);
+    auto scopes = nv.getFileScopeRanges(pkg);
+    if (symbols == nullptr || scopes == nullptr)
+      continue;
+    for (auto &sym : *symbols) {
+      if (sym.scope == NodeVisitor::no_scope)
+        continue;
+      auto &scope = (*scopes)[sym.scope];
+      // Only the package level, not the functions inside
+      auto package = nv.findPackage(scope.name);
+      if (package == nullptr || package->first != pkg ||
+          package->second != sym.scope)
+        continue;
+      package_items[std::string(scope.name)].push_back(makeItem(sym));
+    }
+  }
+}
+
+lsCompletionItem CompletionCatalog::makeItem(const NodeVisitor::syminfo &sym) {
+  lsCompletionItem it;
+  it.label = std::string(sym.name);
+  it.detail = std::string(sym.type_name);
+  it.documentation = std::make_pair(std::string(sym.parent_name), std::nullopt);
+  it.kind = sym.kind;
+  return it;
+}
+
+const CompletionCatalog::file_catalog *
+CompletionCatalog::getFileItems(FileId file) const {
+  auto res = file_items.find(file);
+  if (res == file_items.end())
+    return nullptr;
+  return &res->second;
+}
+
+const std::vector<lsCompletionItem> *
+CompletionCatalog::getPackageItems(std::string_view package) const {
+  auto res = package_items.find(std::string(package));
+  if (res == package_items.end())
+    return nullptr;
+  return &res->second;
+}
+
+const std::vector<lsCompletionItem> &CompletionCatalog::getKeywords() {
+  // Built on first use, the initialization is thread safe
+  static const std::vector<lsCompletionItem> items = []() {
+    std::vector<lsCompletionItem> result;
+    result.reserve(verilog_keywords.size() + systemverilog_keywords.size());
+    for (auto key : verilog_keywords) {
+      lsCompletionItem it;
+      it.label = std::string(key);
+      it.kind = lsCompletionItemKind::Keyword;
+      result.push_back(std::move(it));
+    }
+    for (auto key : systemverilog_keywords) {
+      lsCompletionItem it;
+      it.label = std::string(key);
+      it.kind = lsCompletionItemKind::Keyword;
+      result.push_back(std::move(it));
+    }
+    return result;
+  }();
+  return items;
+}
+
+const std::vector<lsCompletionItem> &CompletionCatalog::getSystemFunctions() {
+  static const std::vector<lsCompletionItem> items = []() {
+    std::vector<lsCompletionItem> result;
+    result.reserve(verilog_system_functions.size());
+    for (auto key : verilog_system_functions) {
+      lsCompletionItem it;
+      it.label = std::string(key);
+      // The $ is already typed
+      it.insertText = std::string(key.substr(1));
+      it.kind = lsCompletionItemKind::Function;
+      result.push_back(std::move(it));
+    }
+    return result;
+  }();
+  return items;
+}
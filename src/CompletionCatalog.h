@@ -0,0 +1,39 @@
+#pragma once
+#include "FileTable.h"
+#include "LibLsp/lsp/lsp_completion.h"
+#include "NodeVisitor.h"
+#include <flat_hash_map.hpp>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Ready to send completion items. The keyword and system function lists are
+// built once per process, the symbol lists once per compilation, so a
+// completion request only filters and copies them.
+class CompletionCatalog {
+public:
+  // Items of a file, each with the scope declaring it
+  struct file_catalog {
+    std::vector<lsCompletionItem> items;
+    std::vector<uint32_t> scopes;
+  };
+
+  // Build the items of the given files and of all the packages
+  CompletionCatalog(const NodeVisitor &nv, const std::vector<FileId> &files);
+
+  // Symbols and scope types of a file, nullptr if it was not indexed
+  const file_catalog *getFileItems(FileId file) const;
+  // Symbols declared at the top of a package, nullptr if unknown
+  const std::vector<lsCompletionItem> *
+  getPackageItems(std::string_view package) const;
+
+  static const std::vector<lsCompletionItem> &getKeywords();
+  static const std::vector<lsCompletionItem> &getSystemFunctions();
+
+private:
+  static lsCompletionItem makeItem(const NodeVisitor::syminfo &sym);
+
+  slang::flat_hash_map<FileId, file_catalog> file_items;
+  slang::flat_hash_map<std::string, std::vector<lsCompletionItem>>
+      package_items;
+};
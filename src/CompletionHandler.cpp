@@ -1,90 +1,138 @@
 #include "CompletionHandler.h"
+#include "FuzzyMatch.h"
 #include "LibLsp/lsp/lsp_completion.h"
+#include <algorithm>
+#include <fmt/core.h>
 #include <optional>
 
-CompletionHandler::CompletionHandler(std::shared_ptr<NodeVisitor> node_visitor)
-    : nv(node_visitor) {}
+CompletionHandler::CompletionHandler(
+    std::shared_ptr<const NodeVisitor> node_visitor,
+    std::shared_ptr<const CompletionCatalog> completion_catalog,
+    size_t max_results, std::function<bool()> abandoned)
+    : nv(node_visitor), catalog(completion_catalog), limit(max_results),
+      abandoned(std::move(abandoned)) {}
 
-void CompletionHandler::complete(const std::string &line,
-                                 std::string_view fname,
+void CompletionHandler::complete(const std::string &line, FileId file,
+                                 uint64_t position,
                                  td_completion::response &resp, int arrayLevels) {
+  collect(line, file, position, arrayLevels);
+  // The client asks again, if it still wants the items
+  if (abandoned && abandoned()) {
+    candidates.clear();
+    resp.result.isIncomplete = true;
+    return;
+  }
+
+  // Best matches first, alphabetically among the same score
+  std::sort(candidates.begin(), candidates.end(),
+            [](const candidate &a, const candidate &b) {
+              if (a.score != b.score)
+                return a.score > b.score;
+              return a.item->label < b.item->label;
+            });
+
+  // The client asks again when more is typed, if the list is cut
+  resp.result.isIncomplete = candidates.size() > limit;
+  if (candidates.size() > limit)
+    candidates.resize(limit);
+
+  // Only the items sent are copied
+  auto &items = resp.result.items;
+  items.reserve(candidates.size());
+  for (auto &cand : candidates) {
+    items.push_back(*cand.item);
+    // Keep our ranking in the client
+    items.back().sortText = fmt::format("{:05}", items.size() - 1);
+  }
+  candidates.clear();
+}
+
+void CompletionHandler::collect(const std::string &line, FileId file,
+                                uint64_t position, int arrayLevels) {
   if (line[0] == '$') {
     // We are autocompleting a system function
-    // Give the full list
-    add_sysfuncs(resp.result.items);
+    prefix = line;
+    addCandidates(CompletionCatalog::getSystemFunctions());
     return;
   }
 
+  // Scopes around the cursor, innermost first
+  std::vector<uint32_t> chain;
+  if (nv != nullptr)
+    chain = nv->getScopeChain(file, position);
+
   // Try to complete the struct, if it succeeds, we are done
-  if (complete_struct(line, fname, resp.result.items, arrayLevels))
+  if (complete_struct(line, file, chain, arrayLevels))
+    return;
+  if (complete_package(line))
     return;
 
   /***************************
    *   REGULAR COMPLETION    *
    ***************************/
+  prefix = line.substr(line.find_last_of('.') + 1);
   // Add the Verilog and SystemVerilog Keywords
-  add_keywords(resp.result.items);
+  addCandidates(CompletionCatalog::getKeywords());
 
   //  No compilation yet, return a basic response
-  if (nv == nullptr)
+  if (catalog == nullptr)
     return;
 
-  add_file_symbols(fname, resp.result.items);
-  add_package_symbols(resp.result.items);
+  // Symbols visible from the cursor and the ones of the imported packages
+  auto file_items = catalog->getFileItems(file);
+  if (file_items != nullptr)
+    addCandidates(*file_items, chain);
+  if (nv == nullptr)
+    return;
+  for (auto package : nv->getImports(file, chain)) {
+    if (abandoned && abandoned())
+      return;
+    auto items = catalog->getPackageItems(package);
+    if (items != nullptr)
+      addCandidates(*items);
+  }
 }
 
-void CompletionHandler::add_file_symbols(std::string_view fname,
-                                         std::vector<lsCompletionItem> &items) {
-  // Get symbols from the current file
-  const auto symbols = nv->getFileSymbols(fname);
-  if (symbols != nullptr) {
-    for (auto &&[key, item] : *symbols) {
-      lsCompletionItem it;
-      it.label = key;
-      it.detail = item.type_name;
-      it.documentation = std::make_pair(item.parent_name, std::nullopt);
-      it.kind = item.kind;
-      items.push_back(it);
-    }
-  }
+bool CompletionHandler::complete_package(const std::string &line) {
+  auto sep = line.rfind("::");
+  if (sep == std::string::npos || sep == 0 || catalog == nullptr)
+    return false;
 
-  const auto& filescopes = nv->getFileScopes(fs::canonical(fname));
-  for(const auto& scope : filescopes) {
-      std::cerr<< "Got Scope " << scope << std::endl;
-    const auto& scopeTypes = nv->getScopeTypes(scope);
-    for(const auto& tname : scopeTypes) {
-      std::cerr<< "  t " << tname << std::endl;
-        lsCompletionItem it;
-        it.label = tname;
-        it.documentation = std::make_pair(scope, std::nullopt);
-        it.kind = lsCompletionItemKind::Reference;
-        items.push_back(it);
-    }
+  // From here on the text can only be a package member
+  prefix = line.substr(sep + 2);
+  auto package = std::string_view(line).substr(0, sep);
+  package = package.substr(package.find_last_of(":.") + 1);
+  auto items = catalog->getPackageItems(package);
+  if (items != nullptr)
+    addCandidates(*items);
+  return true;
+}
+
+void CompletionHandler::addCandidates(
+    const std::vector<lsCompletionItem> &items) {
+  for (auto &item : items) {
+    int score = fuzzyMatch(prefix, item.label);
+    if (score >= 0)
+      candidates.push_back({score, &item});
   }
 }
 
-void CompletionHandler::add_package_symbols(
-    std::vector<lsCompletionItem> &items) {
-  // Get symbols from all the loaded packages
-  const auto &pkgs = nv->getPackageList();
-  for (auto &pkg : pkgs) {
-    const auto pkg_syms = nv->getFileSymbols(pkg);
-    if (pkg_syms != nullptr) {
-      for (auto &&[key, item] : *pkg_syms) {
-        lsCompletionItem it;
-        it.label = key;
-        it.detail = item.type_name;
-        it.documentation = std::make_pair(item.parent_name, std::nullopt);
-        it.kind = item.kind;
-        items.push_back(it);
-      }
-    }
+void CompletionHandler::addCandidates(
+    const CompletionCatalog::file_catalog &catalog,
+    const std::vector<uint32_t> &chain) {
+  for (size_t i = 0; i < catalog.items.size(); i++) {
+    auto scope = catalog.scopes[i];
+    if (scope != NodeVisitor::no_scope &&
+        std::find(chain.begin(), chain.end(), scope) == chain.end())
+      continue;
+    int score = fuzzyMatch(prefix, catalog.items[i].label);
+    if (score >= 0)
+      candidates.push_back({score, &catalog.items[i]});
   }
 }
 
-bool CompletionHandler::complete_struct(const std::string &line,
-                                        std::string_view fname,
-                                        std::vector<lsCompletionItem> &items,
+bool CompletionHandler::complete_struct(const std::string &line, FileId file,
+                                        const std::vector<uint32_t> &chain,
                                         int arrayLevels) {
   /***************************
    *   STRUCT COMPLETION    *
@@ -114,8 +162,7 @@ bool CompletionHandler::complete_struct(const std::string &line,
   }
 
   // Try to obtain the symbols visible from the file
-  const auto fsymbols = nv->getFileSymbols(fname);
-  if (fsymbols == nullptr)
+  if (nv->getFileSymbols(file) == nullptr)
     return true;
 
   // Search the struct base symbol
@@ -124,22 +171,22 @@ bool CompletionHandler::complete_struct(const std::string &line,
   if(arrayLevels > 0)
     base = base.substr(0, base.find_first_of('['));
 
-  auto res = fsymbols->find(base);
+  auto res = nv->findSymbol(file, base, chain);
   // Symbol not found
-  if (res == fsymbols->end())
+  if (res == nullptr)
     return false;
-  const auto &symtype = res->second.struct_name;
+  const auto &symtype = res->struct_name;
 
   // Check that we have matching array levels, otherwise we are
   // still in an array
-  if (arrayLevels != res->second.arrayLevels)
+  if (arrayLevels != res->arrayLevels)
     return true;
   std::cerr << "We do have a struct called " << symtype << std::endl;
 
   // Iterate the struct chain to get the last structinfo
   auto struct_i = nv->getStructInfo(symtype);
   if (struct_i == nullptr)
-    struct_i = nv->getStructInfo(std::string(base));
+    struct_i = nv->getStructInfo(base);
 
   for (int i = 1; i < struct_path.size(); ++i) {
     auto act = struct_path[i];
@@ -156,40 +203,17 @@ bool CompletionHandler::complete_struct(const std::string &line,
   if (struct_i == nullptr)
     return false;
 
-  // Insert members into the completion
+  // Insert the members matching the text after the dot
+  prefix = line.substr(dotpos + 1);
+  member_items.reserve(struct_i->size());
   for (auto &member : *struct_i) {
     lsCompletionItem it;
-    it.label = member.name;
+    it.label = std::string(member.name);
     it.kind = member.kind;
-    it.detail = member.type_name;
-    items.emplace_back(it);
+    it.detail = std::string(member.type_name);
+    member_items.push_back(std::move(it));
   }
+  addCandidates(member_items);
 
   return true;
 }
-
-void CompletionHandler::add_sysfuncs(std::vector<lsCompletionItem> &items) {
-  for (const auto &key : verilog_system_functions) {
-    lsCompletionItem it;
-    it.label = key;
-    it.insertText = key.substr(1);
-    it.kind = lsCompletionItemKind::Function;
-    items.push_back(it);
-  }
-}
-
-void CompletionHandler::add_keywords(std::vector<lsCompletionItem> &items) {
-  // Fill the completion with all the verilog keywords
-  for (const auto &key : verilog_keywords) {
-    lsCompletionItem it;
-    it.label = key;
-    it.kind = lsCompletionItemKind::Keyword;
-    items.push_back(it);
-  }
-  for (const auto &key : systemverilog_keywords) {
-    lsCompletionItem it;
-    it.label = key;
-    it.kind = lsCompletionItemKind::Keyword;
-    items.push_back(it);
-  }
-}
@@ -1,27 +1,28 @@
 #include "DiagnosticParser.h"
-#include "LibLsp/lsp/AbsolutePath.h"
 #include "LibLsp/lsp/lsp_diagnostic.h"
+#include "ProjectSources.h"
 #include <fmt/core.h>
 #include <slang/text/SourceManager.h>
 #include <slang/util/SmallVector.h>
 #include <sstream>
 
-DiagnosticParser::DiagnosticParser(lsp::Log &log) : logger(log) {}
+DiagnosticParser::DiagnosticParser(lsp::Log &log,
+                                   ProjectSources &project_sources)
+    : logger(log), positions(project_sources) {}
 
 void DiagnosticParser::clearDiagnostics() { diagnostics.clear(); }
 
-const std::map<std::string, std::vector<lsDiagnostic>> &
+const std::map<FileId, std::vector<lsDiagnostic>> &
 DiagnosticParser::getDiagnostics() {
   return diagnostics;
 }
 
 void DiagnosticParser::report(const slang::ReportedDiagnostic &diagnostic) {
-  auto sm = this->sourceManager;
-  std::string rel_filename(sm->getFileName(diagnostic.location));
-  auto filename = AbsolutePath(rel_filename).path;
-
-  int line = sm->getLineNumber(diagnostic.location);
-  int col = sm->getColumnNumber(diagnostic.location);
+  positions.setSourceManager(sourceManager);
+  FileId file = positions.getFile(diagnostic.location);
+  // Not in any file, nowhere to show it
+  if (file == FileTable::invalid)
+    return;
 
   // Get all highlight ranges mapped into the reported location of the
   // diagnostic.
@@ -30,8 +31,7 @@ void DiagnosticParser::report(const slang::ReportedDiagnostic &diagnostic) {
 
   lsDiagnostic lsp_diagnostic;
   lsp_diagnostic.message = diagnostic.formattedMessage;
-  lsp_diagnostic.range.start.line = line - 1;
-  lsp_diagnostic.range.start.character = col - 1;
+  lsp_diagnostic.range.start = positions.getPosition(diagnostic.location);
   lsp_diagnostic.range.end = lsp_diagnostic.range.start;
 
   // Map the severity enum
@@ -53,23 +53,11 @@ void DiagnosticParser::report(const slang::ReportedDiagnostic &diagnostic) {
   }
 
   for (auto &range : mappedRanges) {
-    int s_line = sm->getLineNumber(range.start());
-    int e_line = sm->getLineNumber(range.end());
-    int s_col = sm->getColumnNumber(range.start());
-    int e_col = sm->getColumnNumber(range.end());
-
     // Overwrite last range because idk
-    lsp_diagnostic.range.start.character = s_col - 1;
-    lsp_diagnostic.range.start.line = s_line - 1;
-    lsp_diagnostic.range.end.character = e_col - 1;
-    lsp_diagnostic.range.end.line = e_line - 1;
+    lsp_diagnostic.range.start = positions.getPosition(range.start());
+    lsp_diagnostic.range.end = positions.getPosition(range.end());
   }
 
   // Write diag to the diagnostics map
-  auto res = diagnostics.find(filename);
-  if (res == diagnostics.end()) {
-    // Add new Entry
-    diagnostics[filename].push_back(lsp_diagnostic);
-  } else
-    res->second.push_back(lsp_diagnostic);
+  diagnostics[file].push_back(lsp_diagnostic);
 }
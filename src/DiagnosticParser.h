@@ -1,21 +1,27 @@
+#include "FileTable.h"
 #include "LibLsp/JsonRpc/MessageIssue.h"
 #include "LibLsp/lsp/lsp_diagnostic.h"
+#include "SourcePositions.h"
 #include "slang/diagnostics/DiagnosticEngine.h"
 #include <slang/diagnostics/DiagnosticClient.h>
+#include <memory>
 #include <string_view>
 
 #pragma once
 
+class ProjectSources;
+
 class DiagnosticParser : public slang::DiagnosticClient {
 public:
-  DiagnosticParser(lsp::Log &log);
+  DiagnosticParser(lsp::Log &log, ProjectSources &project_sources);
   ~DiagnosticParser() = default;
   void report(const slang::ReportedDiagnostic &diagnostic);
 
   void clearDiagnostics();
-  const std::map<std::string, std::vector<lsDiagnostic>> &getDiagnostics();
+  const std::map<FileId, std::vector<lsDiagnostic>> &getDiagnostics();
 
 private:
   lsp::Log &logger;
-  std::map<std::string, std::vector<lsDiagnostic>> diagnostics;
+  SourcePositions positions;
+  std::map<FileId, std::vector<lsDiagnostic>> diagnostics;
 };
@@ -0,0 +1,65 @@
+#include "DiagnosticStore.h"
+#include <functional>
+
+static void hashCombine(size_t &seed, size_t value) {
+  seed ^= value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2);
+}
+
+size_t DiagnosticStore::hashDiagnostics(
+    const std::vector<lsDiagnostic> &diagnostics) {
+  size_t seed = diagnostics.size();
+  for (auto &diag : diagnostics) {
+    hashCombine(seed, diag.range.start.line);
+    hashCombine(seed, diag.range.start.character);
+    hashCombine(seed, diag.range.end.line);
+    hashCombine(seed, diag.range.end.character);
+    if (diag.severity.has_value())
+      hashCombine(seed, static_cast<size_t>(diag.severity.value()));
+    hashCombine(seed, std::hash<std::string>{}(diag.message));
+  }
+  return seed;
+}
+
+bool DiagnosticStore::sameDiagnostics(const std::vector<lsDiagnostic> &a,
+                                      const std::vector<lsDiagnostic> &b) {
+  if (a.size() != b.size())
+    return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    auto &x = a[i], &y = b[i];
+    if (x.range.start.line != y.range.start.line ||
+        x.range.start.character != y.range.start.character ||
+        x.range.end.line != y.range.end.line ||
+        x.range.end.character != y.range.end.character ||
+        x.severity != y.severity || x.message != y.message)
+      return false;
+  }
+  return true;
+}
+
+bool DiagnosticStore::update(FileId file,
+                             const std::vector<lsDiagnostic> &diagnostics) {
+  size_t hash = hashDiagnostics(diagnostics);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto res = files.find(file);
+  if (res != files.end() && res->second.hash == hash &&
+      sameDiagnostics(res->second.diagnostics, diagnostics))
+    return false;
+
+  files[file] = {hash, ++last_result_id, diagnostics};
+  return true;
+}
+
+void DiagnosticStore::get(FileId file, std::vector<lsDiagnostic> &diagnostics,
+                          std::string &result_id) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto res = files.find(file);
+  if (res == files.end()) {
+    // Nothing published yet for the file
+    diagnostics.clear();
+    result_id = "0";
+    return;
+  }
+  diagnostics = res->second.diagnostics;
+  result_id = std::to_string(res->second.result_id);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "FileTable.h"
+#include "LibLsp/lsp/lsp_diagnostic.h"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Last diagnostics sent for every file. Used to skip sending the ones that
+// did not change, and to answer the diagnostic pull requests.
+class DiagnosticStore {
+public:
+  // Store the diagnostics of a file, returns false if they did not change
+  bool update(FileId file, const std::vector<lsDiagnostic> &diagnostics);
+  // Get the stored diagnostics of a file and their result id
+  void get(FileId file, std::vector<lsDiagnostic> &diagnostics,
+           std::string &result_id) const;
+
+private:
+  struct entry {
+    size_t hash;
+    uint64_t result_id;
+    std::vector<lsDiagnostic> diagnostics;
+  };
+
+  static size_t hashDiagnostics(const std::vector<lsDiagnostic> &diagnostics);
+  // Compares the fields of the hash, in case the hashes collide
+  static bool sameDiagnostics(const std::vector<lsDiagnostic> &a,
+                              const std::vector<lsDiagnostic> &b);
+
+  mutable std::mutex mutex;
+  std::map<FileId, entry> files;
+  uint64_t last_result_id = 0;
+};
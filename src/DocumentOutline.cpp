@@ -0,0 +1,307 @@
+#include "DocumentOutline.h"
+#include <algorithm>
+#include <slang/syntax/AllSyntax.h>
+#include <slang/syntax/SyntaxVisitor.h>
+
+// Builds the hierarchy of the declarations, as shown in the outline
+class OutlineCollector : public slang::SyntaxVisitor<OutlineCollector> {
+public:
+  explicit OutlineCollector(const DocumentOutline &outline)
+      : outline(outline), levels(1) {}
+
+  std::vector<lsDocumentSymbol> getSymbols() { return std::move(levels[0]); }
+
+  void handle(const slang::ModuleDeclarationSyntax &syntax) {
+    lsSymbolKind kind = lsSymbolKind::Module;
+    if (syntax.kind == slang::SyntaxKind::PackageDeclaration)
+      kind = lsSymbolKind::Package;
+    else if (syntax.kind == slang::SyntaxKind::InterfaceDeclaration)
+      kind = lsSymbolKind::Interface;
+    addScope(syntax, syntax.header->name, kind,
+             syntax.header->moduleKeyword.valueText());
+  }
+
+  void handle(const slang::ClassDeclarationSyntax &syntax) {
+    addScope(syntax, syntax.name, lsSymbolKind::Class,
+             syntax.classKeyword.valueText());
+  }
+
+  // The locals of the body are not part of the outline
+  void handle(const slang::FunctionDeclarationSyntax &syntax) {
+    auto &prototype = *syntax.prototype;
+    add(syntax, prototype.name->getLastToken(),
+        in_class ? lsSymbolKind::Method : lsSymbolKind::Function,
+        prototype.keyword.valueText());
+  }
+
+  void handle(const slang::ProceduralBlockSyntax &) {}
+
+  void handle(const slang::TypedefDeclarationSyntax &syntax) {
+    lsSymbolKind kind = lsSymbolKind::TypeParameter;
+    if (syntax.type->kind == slang::SyntaxKind::StructType ||
+        syntax.type->kind == slang::SyntaxKind::UnionType)
+      kind = lsSymbolKind::Struct;
+    else if (syntax.type->kind == slang::SyntaxKind::EnumType)
+      kind = lsSymbolKind::Enum;
+    addScope(syntax, syntax.name, kind, syntax.typedefKeyword.valueText());
+  }
+
+  void handle(const slang::StructUnionMemberSyntax &syntax) {
+    for (auto decl : syntax.declarators)
+      add(*decl, decl->name, lsSymbolKind::Field);
+  }
+
+  void handle(const slang::EnumTypeSyntax &syntax) {
+    for (auto member : syntax.members)
+      add(*member, member->name, lsSymbolKind::EnumMember);
+  }
+
+  void handle(const slang::DataDeclarationSyntax &syntax) {
+    for (auto decl : syntax.declarators)
+      add(*decl, decl->name,
+          in_class ? lsSymbolKind::Field : lsSymbolKind::Variable);
+  }
+
+  void handle(const slang::NetDeclarationSyntax &syntax) {
+    for (auto decl : syntax.declarators)
+      add(*decl, decl->name, lsSymbolKind::Variable,
+          syntax.netType.valueText());
+  }
+
+  void handle(const slang::ParameterDeclarationSyntax &syntax) {
+    for (auto decl : syntax.declarators)
+      add(*decl, decl->name, lsSymbolKind::Constant,
+          syntax.keyword.valueText());
+  }
+
+  void handle(const slang::TypeParameterDeclarationSyntax &syntax) {
+    for (auto decl : syntax.declarators)
+      add(*decl, decl->name, lsSymbolKind::TypeParameter,
+          syntax.keyword.valueText());
+  }
+
+  void handle(const slang::ImplicitAnsiPortSyntax &syntax) {
+    add(syntax, syntax.declarator->name, lsSymbolKind::Field, "port");
+  }
+
+  void handle(const slang::HierarchyInstantiationSyntax &syntax) {
+    for (auto instance : syntax.instances) {
+      if (instance->decl != nullptr)
+        add(*instance, instance->decl->name, lsSymbolKind::Object,
+            syntax.type.valueText());
+    }
+  }
+
+  // Unnamed blocks add no level, their declarations belong to the parent
+  void handle(const slang::GenerateBlockSyntax &syntax) {
+    if (syntax.beginName != nullptr)
+      addScope(syntax, syntax.beginName->name, lsSymbolKind::Namespace);
+    else if (syntax.label != nullptr)
+      addScope(syntax, syntax.label->name, lsSymbolKind::Namespace);
+    else
+      visitDefault(syntax);
+  }
+
+private:
+  std::optional<lsDocumentSymbol> makeSymbol(const slang::SyntaxNode &node,
+                                             slang::Token name,
+                                             lsSymbolKind kind,
+                                             std::string_view detail) {
+    auto text = name.valueText();
+    if (text.empty())
+      return std::nullopt;
+    auto range = outline.getOffsets(node);
+    auto name_range = outline.getOffsets(name);
+    // The name must be inside the range, as required by the clients
+    if (!range || !name_range || name_range->first < range->first ||
+        name_range->second > range->second)
+      return std::nullopt;
+    lsDocumentSymbol sym;
+    sym.name = std::string(text);
+    if (!detail.empty())
+      sym.detail = std::string(detail);
+    sym.kind = kind;
+    sym.range = outline.getRange(*range);
+    sym.selectionRange = outline.getRange(*name_range);
+    return sym;
+  }
+
+  void add(const slang::SyntaxNode &node, slang::Token name, lsSymbolKind kind,
+           std::string_view detail = {}) {
+    auto sym = makeSymbol(node, name, kind, detail);
+    if (sym)
+      levels.back().push_back(std::move(*sym));
+  }
+
+  // The declarations found while visiting the node become its children
+  template <typename T>
+  void addScope(const T &syntax, slang::Token name, lsSymbolKind kind,
+                std::string_view detail = {}) {
+    auto sym = makeSymbol(syntax, name, kind, detail);
+    if (!sym) {
+      visitDefault(syntax);
+      return;
+    }
+    bool outer_class = in_class;
+    in_class = kind == lsSymbolKind::Class;
+    levels.emplace_back();
+    visitDefault(syntax);
+    in_class = outer_class;
+
+    auto children = std::move(levels.back());
+    levels.pop_back();
+    if (!children.empty())
+      sym->children = std::move(children);
+    levels.back().push_back(std::move(*sym));
+  }
+
+  const DocumentOutline &outline;
+  // Symbols of the scopes being visited, the first level is the file
+  std::vector<std::vector<lsDocumentSymbol>> levels;
+  bool in_class = false;
+};
+
+// Finds the blocks spanning several lines
+class FoldingCollector : public slang::SyntaxVisitor<FoldingCollector> {
+public:
+  FoldingCollector(const DocumentOutline &outline,
+                   std::vector<FoldingRange> &ranges)
+      : outline(outline), ranges(ranges) {}
+
+  void handle(const slang::ModuleDeclarationSyntax &syntax) { fold(syntax); }
+  void handle(const slang::ClassDeclarationSyntax &syntax) { fold(syntax); }
+  void handle(const slang::FunctionDeclarationSyntax &syntax) { fold(syntax); }
+  void handle(const slang::TypedefDeclarationSyntax &syntax) { fold(syntax); }
+  void handle(const slang::AnsiPortListSyntax &syntax) { fold(syntax); }
+  void handle(const slang::ParameterPortListSyntax &syntax) { fold(syntax); }
+  void handle(const slang::HierarchyInstantiationSyntax &syntax) {
+    fold(syntax);
+  }
+  void handle(const slang::GenerateBlockSyntax &syntax) { fold(syntax); }
+  void handle(const slang::BlockStatementSyntax &syntax) { fold(syntax); }
+  void handle(const slang::CaseStatementSyntax &syntax) { fold(syntax); }
+
+private:
+  // The last line stays visible, it has the closing keyword
+  template <typename T> void fold(const T &syntax) {
+    auto range = outline.getOffsets(syntax);
+    if (range) {
+      auto &lines = outline.lines;
+      size_t start = lines.lineOf(range->first);
+      size_t end = lines.lineOf(range->second);
+      if (end > start + 1) {
+        FoldingRange res;
+        res.startLine = static_cast<int>(start);
+        res.startCharacter = static_cast<int>(
+            lines.positionAt(range->first).character);
+        res.endLine = static_cast<int>(end - 1);
+        res.endCharacter = static_cast<int>(
+            LineIndex::utf16Length(lines.getLine(end - 1)));
+        res.kind = "region";
+        ranges.push_back(std::move(res));
+      }
+    }
+    visitDefault(syntax);
+  }
+
+  const DocumentOutline &outline;
+  std::vector<FoldingRange> &ranges;
+};
+
+DocumentOutline::DocumentOutline(const slang::SyntaxTree &tree,
+                                 const slang::SourceManager &sm,
+                                 const LineIndex &lines)
+    : tree(tree), sm(sm), lines(lines),
+      // The end of file is never included from elsewhere
+      buffer(tree.root().getLastToken().location().buffer()) {}
+
+std::vector<lsDocumentSymbol> DocumentOutline::getSymbols() const {
+  OutlineCollector collector(*this);
+  collector.visit(tree.root());
+  return collector.getSymbols();
+}
+
+std::vector<FoldingRange> DocumentOutline::getFoldingRanges() const {
+  std::vector<FoldingRange> res;
+  FoldingCollector collector(*this, res);
+  collector.visit(tree.root());
+  return res;
+}
+
+std::vector<lsRange>
+DocumentOutline::getSelectionRanges(const lsPosition &position) const {
+  size_t offset = lines.offsetAt(position.line, position.character);
+  auto contains = [offset](const std::optional<offsets> &range) {
+    return range && range->first <= offset && offset <= range->second;
+  };
+
+  // Walk down the tree through the nodes containing the position
+  std::vector<offsets> chain;
+  auto add = [&](const offsets &range) {
+    if (chain.empty() || chain.back() != range)
+      chain.push_back(range);
+  };
+  const slang::SyntaxNode *node = &tree.root();
+  while (node != nullptr) {
+    auto range = getOffsets(*node);
+    if (range)
+      add(*range);
+    const slang::SyntaxNode *next = nullptr;
+    for (size_t i = 0; i < node->getChildCount() && next == nullptr; i++) {
+      auto child = node->childNode(i);
+      if (child != nullptr) {
+        if (contains(getOffsets(*child)))
+          next = child;
+        continue;
+      }
+      auto token = node->childToken(i);
+      if (!token.valid())
+        continue;
+      auto token_range = getOffsets(token);
+      if (contains(token_range)) {
+        add(*token_range);
+        break;
+      }
+    }
+    node = next;
+  }
+
+  std::vector<lsRange> res;
+  for (auto it = chain.rbegin(); it != chain.rend(); it++)
+    res.push_back(getRange(*it));
+  return res;
+}
+
+std::optional<DocumentOutline::offsets>
+DocumentOutline::getOffsets(slang::SourceRange range) const {
+  auto start = sm.getFullyOriginalLoc(range.start());
+  auto end = sm.getFullyOriginalLoc(range.end());
+  if (start.buffer() != buffer || end.buffer() != buffer)
+    return std::nullopt;
+  // A range ending in a macro expansion maps to the start of its use
+  return offsets(start.offset(), std::max(start.offset(), end.offset()));
+}
+
+std::optional<DocumentOutline::offsets>
+DocumentOutline::getOffsets(const slang::SyntaxNode &node) const {
+  auto first = node.getFirstToken();
+  if (!first.valid())
+    return std::nullopt;
+  return getOffsets(node.sourceRange());
+}
+
+std::optional<DocumentOutline::offsets>
+DocumentOutline::getOffsets(slang::Token token) const {
+  return getOffsets(token.range());
+}
+
+lsRange DocumentOutline::getRange(offsets range) const {
+  auto start = lines.positionAt(range.first);
+  auto end = lines.positionAt(range.second);
+  lsRange res;
+  res.start.line = start.line;
+  res.start.character = start.character;
+  res.end.line = end.line;
+  res.end.character = end.character;
+  return res;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "LibLsp/lsp/lsRange.h"
+#include "LibLsp/lsp/symbol.h"
+#include "LibLsp/lsp/textDocument/foldingRange.h"
+#include "LineIndex.h"
+#include <optional>
+#include <slang/syntax/SyntaxTree.h>
+#include <slang/text/SourceManager.h>
+#include <utility>
+#include <vector>
+
+class OutlineCollector;
+class FoldingCollector;
+
+// Structure of a file read from its syntax tree alone: the declarations of
+// the outline, the regions that can be folded and the syntax around a
+// position. Nothing is elaborated, so it works on files that do not compile.
+// Only the parts written in the file itself are reported, not the included
+// ones.
+class DocumentOutline {
+public:
+  DocumentOutline(const slang::SyntaxTree &tree, const slang::SourceManager &sm,
+                  const LineIndex &lines);
+
+  std::vector<lsDocumentSymbol> getSymbols() const;
+  std::vector<FoldingRange> getFoldingRanges() const;
+  // Ranges of the token and the nodes around a position, innermost first
+  std::vector<lsRange> getSelectionRanges(const lsPosition &position) const;
+
+private:
+  friend class OutlineCollector;
+  friend class FoldingCollector;
+
+  typedef std::pair<size_t, size_t> offsets;
+
+  // Offsets in the file of some syntax, nullopt if it is not written there
+  std::optional<offsets> getOffsets(slang::SourceRange range) const;
+  std::optional<offsets> getOffsets(const slang::SyntaxNode &node) const;
+  std::optional<offsets> getOffsets(slang::Token token) const;
+  lsRange getRange(offsets range) const;
+
+  const slang::SyntaxTree &tree;
+  const slang::SourceManager &sm;
+  const LineIndex &lines;
+  slang::BufferID buffer;
+};
@@ -0,0 +1,55 @@
+#include "FileTable.h"
+#include <mutex>
+
+FileId FileTable::getId(const fs::path &path) {
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto res = aliases.find(path.string());
+    if (res != aliases.end())
+      return res->second;
+  }
+  FileId id = intern(path);
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  aliases.emplace(path.string(), id);
+  return id;
+}
+
+FileId FileTable::getId(const lsDocumentUri &uri) {
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto res = uri_aliases.find(uri.raw_uri_);
+    if (res != uri_aliases.end())
+      return res->second;
+  }
+  FileId id = intern(uri.GetAbsolutePath().path);
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  uri_aliases.emplace(uri.raw_uri_, id);
+  return id;
+}
+
+const fs::path &FileTable::getPath(FileId id) const {
+  static const fs::path empty_path;
+  std::shared_lock<std::shared_mutex> lock(mutex);
+  if (id == invalid || id > paths.size())
+    return empty_path;
+  return paths[id - 1];
+}
+
+FileId FileTable::intern(const fs::path &path) {
+  // The only filesystem access, done once per spelling. Files that do not
+  // exist yet (new editor buffers) keep their absolute path.
+  std::error_code ec;
+  fs::path absolute = fs::absolute(path, ec);
+  fs::path canonical = fs::weakly_canonical(absolute, ec);
+  if (ec)
+    canonical = absolute.lexically_normal();
+
+  std::unique_lock<std::shared_mutex> lock(mutex);
+  auto res = canonical_ids.find(canonical.string());
+  if (res != canonical_ids.end())
+    return res->second;
+  paths.push_back(absolute.lexically_normal());
+  FileId id = paths.size();
+  canonical_ids.emplace(canonical.string(), id);
+  return id;
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "LibLsp/lsp/lsDocumentUri.h"
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+typedef uint32_t FileId;
+
+// Interned identities of the files. Every spelling of a path (or URI) is
+// resolved to its canonical file once, later lookups are a hash lookup.
+class FileTable {
+public:
+  // Never returned for a file
+  static constexpr FileId invalid = 0;
+
+  FileId getId(const fs::path &path);
+  FileId getId(const lsDocumentUri &uri);
+  // Path of a file, as it was first seen
+  const fs::path &getPath(FileId id) const;
+
+private:
+  FileId intern(const fs::path &path);
+
+  mutable std::shared_mutex mutex;
+  // Known spellings of the paths and URIs
+  std::unordered_map<std::string, FileId> aliases, uri_aliases;
+  std::unordered_map<std::string, FileId> canonical_ids;
+  // Indexed by id, deque keeps the references valid
+  std::deque<fs::path> paths;
+};
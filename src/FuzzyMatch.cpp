@@ -0,0 +1,47 @@
+#include "FuzzyMatch.h"
+#include <algorithm>
+#include <cctype>
+
+int fuzzyMatch(std::string_view prefix, std::string_view label) {
+  if (prefix.empty())
+    return 0;
+  if (prefix.size() > label.size())
+    return -1;
+
+  // The letters of the prefix must appear in order, ignoring the case.
+  // Matches at the start, at word boundaries and in a row score higher.
+  int score = 0;
+  size_t pos = 0;
+  bool in_row = false;
+  for (size_t i = 0; i < label.size() && pos < prefix.size(); i++) {
+    char c = label[i];
+    if (std::tolower(c) != std::tolower(prefix[pos])) {
+      in_row = false;
+      continue;
+    }
+    int bonus = 1;
+    if (i == 0)
+      bonus += 8;
+    else if (label[i - 1] == '_' || label[i - 1] == '$' ||
+             (std::isupper(c) && std::islower(label[i - 1])))
+      bonus += 4;
+    if (in_row)
+      bonus += 4;
+    if (c == prefix[pos])
+      bonus += 1;
+    score += bonus;
+    in_row = true;
+    pos++;
+  }
+  if (pos < prefix.size())
+    return -1;
+
+  // Labels starting with the prefix go first
+  auto same_letter = [](char a, char b) {
+    return std::tolower(a) == std::tolower(b);
+  };
+  if (std::equal(prefix.begin(), prefix.end(), label.begin(), same_letter))
+    score += 20;
+  // Then the shorter ones
+  return score * 64 - static_cast<int>(std::min<size_t>(label.size(), 63));
+}
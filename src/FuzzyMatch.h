@@ -0,0 +1,7 @@
+#pragma once
+#include <string_view>
+
+// Score of a label for a typed prefix, negative if it does not match.
+// The letters of the prefix must appear in the label in order, ignoring the
+// case. An empty prefix matches everything with score 0.
+int fuzzyMatch(std::string_view prefix, std::string_view label);
@@ -0,0 +1,136 @@
+#include "LibraryIndex.h"
+#include <algorithm>
+#include <thread>
+
+const std::vector<std::string> LibraryIndex::extensions = {"v", "sv"};
+
+void LibraryIndex::update(const std::set<fs::path> &library_dirs,
+                          const std::set<fs::path> &include_dirs,
+                          bool rescan) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!rescan && index.valid() && library_dirs == indexed_library_dirs &&
+      include_dirs == indexed_include_dirs)
+    return;
+
+  indexed_library_dirs = library_dirs;
+  indexed_include_dirs = include_dirs;
+  resolved.clear();
+  missing.clear();
+
+  // Scan in a detached thread, lookups wait for it only if it is not done yet
+  auto promise =
+      std::make_shared<std::promise<std::shared_ptr<const index_data>>>();
+  index = promise->get_future().share();
+  std::thread([promise, library_dirs, include_dirs]() {
+    promise->set_value(scan(library_dirs, include_dirs));
+  }).detach();
+}
+
+std::shared_ptr<const LibraryIndex::index_data>
+LibraryIndex::scan(const std::set<fs::path> &library_dirs,
+                   const std::set<fs::path> &include_dirs) {
+  auto data = std::make_shared<index_data>();
+  data->library_dirs = library_dirs;
+
+  size_t dir_priority = 0;
+  for (auto &dir : library_dirs) {
+    std::error_code ec;
+    for (auto it = fs::directory_iterator(dir, ec);
+         !ec && it != fs::directory_iterator(); it.increment(ec)) {
+      const auto &path = it->path();
+      auto ext = path.extension().string();
+      if (ext.empty())
+        continue;
+      auto ext_pos =
+          std::find(extensions.begin(), extensions.end(), ext.substr(1));
+      if (ext_pos == extensions.end())
+        continue;
+      std::error_code type_ec;
+      if (!it->is_regular_file(type_ec))
+        continue;
+
+      size_t priority =
+          dir_priority * extensions.size() + (ext_pos - extensions.begin());
+      auto name = path.stem().string();
+      auto res = data->libraries.find(name);
+      if (res == data->libraries.end() || priority < res->second.second)
+        data->libraries[name] = std::make_pair(path, priority);
+    }
+    dir_priority++;
+  }
+
+  // Searching headers in empty directories is useless
+  for (auto &dir : include_dirs) {
+    std::error_code ec;
+    if (fs::directory_iterator(dir, ec) != fs::directory_iterator())
+      data->include_dirs.push_back(dir);
+  }
+
+  return data;
+}
+
+std::shared_ptr<const LibraryIndex::index_data> LibraryIndex::getIndex() {
+  std::shared_future<std::shared_ptr<const index_data>> current;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    current = index;
+  }
+  if (!current.valid())
+    return nullptr;
+  return current.get();
+}
+
+fs::path LibraryIndex::findLibraryFile(std::string_view name) {
+  auto data = getIndex();
+  if (data == nullptr)
+    return {};
+
+  std::string key(name);
+  auto res = data->libraries.find(key);
+  if (res != data->libraries.end())
+    return res->second.first;
+
+  // The file may have been created after the scan, look for it only once
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (missing.count(key))
+      return {};
+    auto res_resolved = resolved.find(key);
+    if (res_resolved != resolved.end())
+      return res_resolved->second;
+  }
+
+  fs::path found;
+  for (auto &dir : data->library_dirs) {
+    fs::path path = dir / name;
+    for (auto &ext : extensions) {
+      path.replace_extension(ext);
+      std::error_code ec;
+      if (fs::is_regular_file(path, ec)) {
+        found = path;
+        break;
+      }
+    }
+    if (!found.empty())
+      break;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (found.empty())
+    missing.insert(key);
+  else
+    resolved[key] = found;
+  return found;
+}
+
+std::vector<fs::path> LibraryIndex::getIncludeDirectories() {
+  auto data = getIndex();
+  if (data == nullptr)
+    return {};
+  return data->include_dirs;
+}
+
+void LibraryIndex::clearMissing() {
+  std::lock_guard<std::mutex> lock(mutex);
+  missing.clear();
+}
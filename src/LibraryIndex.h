@@ -0,0 +1,56 @@
+#pragma once
+#include <filesystem>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// Index of the files available in the library and include directories.
+// The directories are listed once in the background, so looking up a module
+// or package does not need to probe the filesystem for every name.
+class LibraryIndex {
+public:
+  // Start indexing the given directories, if they changed since the last
+  // time. With rescan they are indexed again anyway, for the files created
+  // since.
+  void update(const std::set<fs::path> &library_dirs,
+              const std::set<fs::path> &include_dirs, bool rescan = false);
+  // Find the library file for a module/package name, empty if there is none
+  fs::path findLibraryFile(std::string_view name);
+  // Include directories that have any content, in the configured order
+  std::vector<fs::path> getIncludeDirectories();
+  // Forget the names that were not found, new files may have been created
+  void clearMissing();
+
+  static const std::vector<std::string> extensions;
+
+private:
+  struct index_data {
+    std::set<fs::path> library_dirs;
+    // Name -> (path, priority). Lower priorities win, as the first directory
+    // and extension in the search order do.
+    std::unordered_map<std::string, std::pair<fs::path, size_t>> libraries;
+    std::vector<fs::path> include_dirs;
+  };
+
+  static std::shared_ptr<const index_data>
+  scan(const std::set<fs::path> &library_dirs,
+       const std::set<fs::path> &include_dirs);
+  std::shared_ptr<const index_data> getIndex();
+
+  std::mutex mutex;
+  std::set<fs::path> indexed_library_dirs, indexed_include_dirs;
+  std::shared_future<std::shared_ptr<const index_data>> index;
+  // Lookups that were not in the index, checked on the filesystem once
+  std::unordered_map<std::string, fs::path> resolved;
+  std::unordered_set<std::string> missing;
+};
@@ -0,0 +1,65 @@
+#include "LineIndex.h"
+#include <algorithm>
+
+LineIndex::LineIndex(std::string_view text) : text(text) {
+  starts.push_back(0);
+  for (size_t pos = text.find('\n'); pos != std::string_view::npos;
+       pos = text.find('\n', pos + 1))
+    starts.push_back(pos + 1);
+}
+
+size_t LineIndex::lineStart(size_t line) const {
+  if (line >= starts.size())
+    return text.size();
+  return starts[line];
+}
+
+size_t LineIndex::lineOf(size_t offset) const {
+  // starts is never empty and starts with 0
+  return std::upper_bound(starts.begin(), starts.end(), offset) -
+         starts.begin() - 1;
+}
+
+std::string_view LineIndex::getLine(size_t line) const {
+  if (line >= starts.size())
+    return {};
+  auto contents = text.substr(starts[line]);
+  return contents.substr(0, contents.find('\n'));
+}
+
+size_t LineIndex::offsetAt(size_t line, size_t character) const {
+  size_t start = lineStart(line);
+  return start + utf16Offset(text.substr(start), character);
+}
+
+LineIndex::position LineIndex::positionAt(size_t offset) const {
+  offset = std::min(offset, text.size());
+  size_t line = lineOf(offset);
+  size_t start = starts[line];
+  return {line, utf16Length(text.substr(start, offset - start))};
+}
+
+size_t LineIndex::utf16Offset(std::string_view line, size_t character) {
+  size_t units = 0;
+  size_t offset = 0;
+  for (unsigned char c : line) {
+    if ((c & 0xC0) != 0x80) {
+      // Start of a code point
+      if (units >= character || c == '\n')
+        break;
+      // Code points outside the BMP take two UTF-16 units
+      units += c >= 0xF0 ? 2 : 1;
+    }
+    offset++;
+  }
+  return offset;
+}
+
+size_t LineIndex::utf16Length(std::string_view text) {
+  size_t units = 0;
+  for (unsigned char c : text) {
+    if ((c & 0xC0) != 0x80)
+      units += c >= 0xF0 ? 2 : 1;
+  }
+  return units;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+// Offsets of the line starts of a text, to convert between offsets and LSP
+// positions (lines and UTF-16 code units) with a binary search.
+// The text is not copied, it must outlive the index.
+class LineIndex {
+public:
+  struct position {
+    size_t line, character;
+  };
+
+  LineIndex() = default;
+  explicit LineIndex(std::string_view text);
+
+  size_t lineCount() const { return starts.size(); }
+  // Offset of the first character of a line, the text size past the end
+  size_t lineStart(size_t line) const;
+  // Line containing an offset, which is also the newlines before it
+  size_t lineOf(size_t offset) const;
+  // Contents of a line, without the line ending
+  std::string_view getLine(size_t line) const;
+
+  size_t offsetAt(size_t line, size_t character) const;
+  position positionAt(size_t offset) const;
+
+  std::string_view getText() const { return text; }
+
+  // Offset of the given UTF-16 units in a line, stopping at its end
+  static size_t utf16Offset(std::string_view line, size_t character);
+  // UTF-16 units in a text
+  static size_t utf16Length(std::string_view text);
+
+private:
+  std::string_view text;
+  std::vector<size_t> starts;
+};
@@ -0,0 +1,293 @@
+#pragma once
+// LSP messages not provided by LspCpp
+#include "LibLsp/JsonRpc/RequestInMessage.h"
+#include "LibLsp/JsonRpc/lsResponseMessage.h"
+#include "LibLsp/JsonRpc/serializer.h"
+#include "LibLsp/lsp/lsRange.h"
+#include "LibLsp/lsp/lsTextDocumentIdentifier.h"
+#include "LibLsp/lsp/lsp_diagnostic.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+/* ********************************************************************
+ * Pull diagnostics (LSP 3.17)
+ * ********************************************************************/
+struct DocumentDiagnosticParams {
+  lsTextDocumentIdentifier textDocument;
+  std::optional<std::string> identifier;
+  std::optional<std::string> previousResultId;
+};
+MAKE_REFLECT_STRUCT(DocumentDiagnosticParams, textDocument, identifier,
+                    previousResultId);
+
+struct DocumentDiagnosticReport {
+  // "full" or "unchanged", the latter has no items
+  std::string kind;
+  std::optional<std::string> resultId;
+  std::optional<std::vector<lsDiagnostic>> items;
+};
+MAKE_REFLECT_STRUCT(DocumentDiagnosticReport, kind, resultId, items);
+
+DEFINE_REQUEST_RESPONSE_TYPES(td_diagnostic, DocumentDiagnosticParams,
+                              DocumentDiagnosticReport,
+                              "textDocument/diagnostic");
+
+DEFINE_REQUEST_RESPONSE_TYPES(wp_diagnosticRefresh, std::optional<JsonNull>,
+                              std::optional<JsonNull>,
+                              "workspace/diagnostic/refresh");
+
+// Pull diagnostics can only be advertised through dynamic registration,
+// the static capabilities of LspCpp don't have the field
+struct DiagnosticRegistrationOptions {
+  bool interFileDependencies;
+  bool workspaceDiagnostics;
+};
+MAKE_REFLECT_STRUCT(DiagnosticRegistrationOptions, interFileDependencies,
+                    workspaceDiagnostics);
+
+struct DiagnosticRegistration {
+  std::string id;
+  std::string method;
+  DiagnosticRegistrationOptions registerOptions;
+};
+MAKE_REFLECT_STRUCT(DiagnosticRegistration, id, method, registerOptions);
+
+struct DiagnosticRegistrationParams {
+  std::vector<DiagnosticRegistration> registrations;
+};
+MAKE_REFLECT_STRUCT(DiagnosticRegistrationParams, registrations);
+
+DEFINE_REQUEST_RESPONSE_TYPES(client_registerDiagnostics,
+                              DiagnosticRegistrationParams,
+                              std::optional<JsonNull>,
+                              "client/registerCapability");
+
+// Client capabilities newer than LspCpp, which drops them while reading the
+// initialize request, so they are read again from it
+struct DynamicRegistrationCapability {
+  std::optional<bool> dynamicRegistration;
+};
+MAKE_REFLECT_STRUCT(DynamicRegistrationCapability, dynamicRegistration);
+
+struct RefreshCapability {
+  std::optional<bool> refreshSupport;
+};
+MAKE_REFLECT_STRUCT(RefreshCapability, refreshSupport);
+
+struct TextDocumentExtraCapabilities {
+  std::optional<DynamicRegistrationCapability> diagnostic;
+  std::optional<DynamicRegistrationCapability> semanticTokens;
+};
+MAKE_REFLECT_STRUCT(TextDocumentExtraCapabilities, diagnostic, semanticTokens);
+
+struct WorkspaceExtraCapabilities {
+  std::optional<RefreshCapability> diagnostics;
+};
+MAKE_REFLECT_STRUCT(WorkspaceExtraCapabilities, diagnostics);
+
+struct ExtraClientCapabilities {
+  std::optional<TextDocumentExtraCapabilities> textDocument;
+  std::optional<WorkspaceExtraCapabilities> workspace;
+};
+MAKE_REFLECT_STRUCT(ExtraClientCapabilities, textDocument, workspace);
+
+struct ExtraInitializeParams {
+  ExtraClientCapabilities capabilities;
+};
+MAKE_REFLECT_STRUCT(ExtraInitializeParams, capabilities);
+
+DEFINE_REQUEST_RESPONSE_TYPES(sver_initializeCapabilities,
+                              ExtraInitializeParams, std::optional<JsonNull>,
+                              "initialize");
+
+/* ********************************************************************
+ * Selection ranges (LSP 3.15)
+ * ********************************************************************/
+// LspCpp links the parents with raw pointers that outlive the handler, this
+// one keeps the whole chain in a vector and nests it when serialized
+struct SyntaxSelectionParams {
+  lsTextDocumentIdentifier textDocument;
+  std::vector<lsPosition> positions;
+};
+MAKE_REFLECT_STRUCT(SyntaxSelectionParams, textDocument, positions);
+
+struct SyntaxSelectionRange {
+  // Innermost first, each range contains the previous one
+  std::vector<lsRange> ranges;
+};
+
+inline void Reflect(Writer &visitor, SyntaxSelectionRange &value) {
+  if (value.ranges.empty()) {
+    visitor.Null();
+    return;
+  }
+  for (size_t i = 0; i < value.ranges.size(); i++) {
+    visitor.StartObject();
+    visitor.Key("range");
+    Reflect(visitor, value.ranges[i]);
+    if (i + 1 < value.ranges.size())
+      visitor.Key("parent");
+  }
+  for (size_t i = 0; i < value.ranges.size(); i++)
+    visitor.EndObject();
+}
+
+inline void Reflect(Reader &visitor, SyntaxSelectionRange &value) {
+  value.ranges.clear();
+  std::unique_ptr<Reader> parent;
+  Reader *current = &visitor;
+  while (!current->IsNull() && current->HasMember("range")) {
+    value.ranges.emplace_back();
+    Reflect(*(*current)["range"], value.ranges.back());
+    if (!current->HasMember("parent"))
+      break;
+    parent = (*current)["parent"];
+    current = parent.get();
+  }
+}
+
+DEFINE_REQUEST_RESPONSE_TYPES(td_syntaxSelectionRange, SyntaxSelectionParams,
+                              std::vector<SyntaxSelectionRange>,
+                              "textDocument/selectionRange");
+
+/* ********************************************************************
+ * Semantic tokens (LSP 3.16)
+ * ********************************************************************/
+struct SemanticTokenDocumentParams {
+  lsTextDocumentIdentifier textDocument;
+};
+MAKE_REFLECT_STRUCT(SemanticTokenDocumentParams, textDocument);
+
+struct SemanticTokenRangeParams {
+  lsTextDocumentIdentifier textDocument;
+  lsRange range;
+};
+MAKE_REFLECT_STRUCT(SemanticTokenRangeParams, textDocument, range);
+
+struct SemanticTokenDeltaParams {
+  lsTextDocumentIdentifier textDocument;
+  std::string previousResultId;
+};
+MAKE_REFLECT_STRUCT(SemanticTokenDeltaParams, textDocument, previousResultId);
+
+struct SemanticTokenData {
+  std::optional<std::string> resultId;
+  std::vector<uint32_t> data;
+};
+MAKE_REFLECT_STRUCT(SemanticTokenData, resultId, data);
+
+struct SemanticTokenEdit {
+  uint32_t start;
+  uint32_t deleteCount;
+  std::optional<std::vector<uint32_t>> data;
+};
+MAKE_REFLECT_STRUCT(SemanticTokenEdit, start, deleteCount, data);
+
+// Either the edits from the previous result, or all the data when that
+// result is not known anymore
+struct SemanticTokenDeltaData {
+  std::optional<std::string> resultId;
+  std::optional<std::vector<uint32_t>> data;
+  std::optional<std::vector<SemanticTokenEdit>> edits;
+};
+MAKE_REFLECT_STRUCT(SemanticTokenDeltaData, resultId, data, edits);
+
+DEFINE_REQUEST_RESPONSE_TYPES(td_semanticTokensFull,
+                              SemanticTokenDocumentParams, SemanticTokenData,
+                              "textDocument/semanticTokens/full");
+
+DEFINE_REQUEST_RESPONSE_TYPES(td_semanticTokensRange, SemanticTokenRangeParams,
+                              SemanticTokenData,
+                              "textDocument/semanticTokens/range");
+
+DEFINE_REQUEST_RESPONSE_TYPES(td_semanticTokensDelta, SemanticTokenDeltaParams,
+                              SemanticTokenDeltaData,
+                              "textDocument/semanticTokens/full/delta");
+
+// Advertised through dynamic registration too, as the pull diagnostics
+struct SemanticTokenLegend {
+  std::vector<std::string> tokenTypes;
+  std::vector<std::string> tokenModifiers;
+};
+MAKE_REFLECT_STRUCT(SemanticTokenLegend, tokenTypes, tokenModifiers);
+
+struct SemanticTokenFullOptions {
+  bool delta;
+};
+MAKE_REFLECT_STRUCT(SemanticTokenFullOptions, delta);
+
+struct SemanticTokenRegistrationOptions {
+  SemanticTokenLegend legend;
+  bool range;
+  SemanticTokenFullOptions full;
+};
+MAKE_REFLECT_STRUCT(SemanticTokenRegistrationOptions, legend, range, full);
+
+struct SemanticTokenRegistration {
+  std::string id;
+  std::string method;
+  SemanticTokenRegistrationOptions registerOptions;
+};
+MAKE_REFLECT_STRUCT(SemanticTokenRegistration, id, method, registerOptions);
+
+struct SemanticTokenRegistrationParams {
+  std::vector<SemanticTokenRegistration> registrations;
+};
+MAKE_REFLECT_STRUCT(SemanticTokenRegistrationParams, registrations);
+
+DEFINE_REQUEST_RESPONSE_TYPES(client_registerSemanticTokens,
+                              SemanticTokenRegistrationParams,
+                              std::optional<JsonNull>,
+                              "client/registerCapability");
+
+/* ********************************************************************
+ * Server statistics (sver/stats)
+ * ********************************************************************/
+// Times in milliseconds. The percentiles are rounded up to a power of two
+// microseconds.
+struct LatencyStats {
+  std::string name;
+  uint64_t count;
+  double totalMs;
+  double meanMs;
+  double p50Ms;
+  double p90Ms;
+  double p99Ms;
+  double maxMs;
+};
+MAKE_REFLECT_STRUCT(LatencyStats, name, count, totalMs, meanMs, p50Ms, p90Ms,
+                    p99Ms, maxMs);
+
+struct LaneStats {
+  std::string name;
+  uint64_t workers;
+  uint64_t queued;
+  uint64_t running;
+  uint64_t completed;
+  double meanWaitMs;
+  double maxWaitMs;
+};
+MAKE_REFLECT_STRUCT(LaneStats, name, workers, queued, running, completed,
+                    meanWaitMs, maxWaitMs);
+
+struct MemoryStats {
+  uint64_t currentBytes;
+  uint64_t peakBytes;
+};
+MAKE_REFLECT_STRUCT(MemoryStats, currentBytes, peakBytes);
+
+struct ServerStatsReport {
+  // By LSP method, from the arrival of the request to its response
+  std::vector<LatencyStats> requests;
+  // Steps of the compilations
+  std::vector<LatencyStats> phases;
+  std::vector<LaneStats> lanes;
+  MemoryStats memory;
+};
+MAKE_REFLECT_STRUCT(ServerStatsReport, requests, phases, lanes, memory);
+
+DEFINE_REQUEST_RESPONSE_TYPES(sver_stats, std::optional<JsonNull>,
+                              ServerStatsReport, "sver/stats");
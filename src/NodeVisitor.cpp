@@ -1,9 +1,12 @@
 #include "NodeVisitor.h"
 #include "LibLsp/lsp/lsp_completion.h"
+#include "ProjectSources.h"
 #include "slang/symbols/ValueSymbol.h"
 #include "slang/symbols/VariableSymbols.h"
+#include "slang/syntax/SyntaxNode.h"
 #include "slang/syntax/SyntaxPrinter.h"
 #include "slang/types/Type.h"
+#include <algorithm>
 #include <filesystem>
 #include <fmt/core.h>
 #include <memory>
@@ -11,32 +14,184 @@
 
 const std::string WHITESPACE = " \n\r\t\f\v";
 
-NodeVisitor::NodeVisitor(std::shared_ptr<slang::SourceManager> sm) : sm(sm) {}
+NodeVisitor::NodeVisitor(std::shared_ptr<slang::SourceManager> sm,
+                         FileTable &files, std::function<bool()> abandoned)
+    : sm(sm), files(files), abandoned(std::move(abandoned)) {}
+
+FileId NodeVisitor::getFileId(slang::SourceLocation location) {
+  auto buffer = location.buffer().getId();
+  auto res = buffer_files.find(buffer);
+  if (res != buffer_files.end())
+    return res->second;
+
+  auto fname = sm->getFileName(location);
+  FileId file = FileTable::invalid;
+  if (!fname.empty())
+    file = files.getId(ProjectSources::getBufferPath(fname));
+  buffer_files.emplace(buffer, file);
+  return file;
+}
+
+uint64_t NodeVisitor::getPosition(slang::SourceLocation location) {
+  auto file_location = sm->getFullyOriginalLoc(location);
+  return makePosition(sm->getLineNumber(file_location) - 1,
+                      sm->getColumnNumber(file_location) - 1);
+}
+
+uint32_t NodeVisitor::getScopeIndex(const slang::Scope *scope, FileId file) {
+  if (scope == nullptr)
+    return no_scope;
+  auto &sym = scope->asSymbol();
+  if (sym.kind == slang::SymbolKind::Root ||
+      sym.kind == slang::SymbolKind::CompilationUnit)
+    return no_scope;
+  auto syntax = sym.getSyntax();
+  // Scopes without declaration, like the implicit ones, belong to the parent
+  if (syntax == nullptr)
+    return getScopeIndex(sym.getParentScope(), file);
+
+  // Declared in another file, like a macro or an include
+  auto res = scope_ids.find(syntax);
+  if (res != scope_ids.end())
+    return res->second.first == file ? res->second.second : no_scope;
+  auto range = syntax->sourceRange();
+  if (getFileId(sm->getFullyOriginalLoc(range.start())) != file)
+    return no_scope;
+
+  // The parents are set by finish, once all the ranges are known
+  auto &scopes = file_scopes[file];
+  uint32_t index = scopes.size();
+  scopes.push_back({getPosition(range.start()), getPosition(range.end()),
+                    no_scope, strings.intern(sym.name), {}});
+  scope_ids.emplace(syntax, std::make_pair(file, index));
+  return index;
+}
 
 void NodeVisitor::handle_pkg(const slang::PackageSymbol &sym) {
-  auto fname = sm->getFileName(sym.location);
-  fs::path fpath = fs::canonical(fname);
-  last_toplevel = fpath.string();
+  FileId file = getFileId(sym.location);
+
+  known_packages.push_back(file);
 
-  known_packages.push_back(last_toplevel);
+  auto name = strings.intern(sym.name);
+  file2scopes[file].push_back(name);
+  if (file != FileTable::invalid)
+    package_scopes.emplace(name,
+                           std::make_pair(file, getScopeIndex(&sym, file)));
+}
+
+void NodeVisitor::handle_import(const slang::Symbol &sym,
+                                std::string_view package) {
+  FileId file = getFileId(sym.location);
+  if (file == FileTable::invalid || package.empty())
+    return;
 
-  file2scopes[fpath].emplace(sym.name);
+  // Explicit imports bring the whole package, their symbol is not kept
+  auto name = strings.intern(package);
+  auto scope = getScopeIndex(sym.getParentScope(), file);
+  if (scope == no_scope)
+    file_imports[file].push_back(name);
+  else
+    file_scopes[file][scope].imports.push_back(name);
 }
 
 void NodeVisitor::handle_instance(const slang::InstanceSymbolBase &unit) {
-  auto fname = sm->getFileName(unit.location);
-  fs::path fpath = fs::canonical(fname);
+  FileId file = getFileId(unit.location);
 
-  file2scopes[fpath].emplace(unit.name);
+  file2scopes[file].push_back(strings.intern(unit.name));
 }
 
-const std::set<std::string> &NodeVisitor::getFileScopes(const fs::path &file) {
-  return file2scopes[file];
+const std::vector<std::string_view> &
+NodeVisitor::getFileScopes(FileId file) const {
+  auto res = file2scopes.find(file);
+  if (res == file2scopes.end())
+    return empty_list;
+  return res->second;
 }
 
-const std::set<std::string> &
-NodeVisitor::getScopeTypes(std::string_view scope) {
-  return known_types[scope];
+const std::vector<std::string_view> &
+NodeVisitor::getScopeTypes(std::string_view scope) const {
+  auto res = known_types.find(scope);
+  if (res == known_types.end())
+    return empty_list;
+  return res->second;
+}
+
+// Sort a list of names and remove the repeated ones
+static void sortUnique(std::vector<std::string_view> &names) {
+  std::sort(names.begin(), names.end());
+  names.erase(std::unique(names.begin(), names.end()), names.end());
+  names.shrink_to_fit();
+}
+
+// Sort the scopes of a file by start, outer ones first, and link each one
+// to the scope containing it. Returns the new index of each old one.
+static std::vector<uint32_t>
+sortScopes(std::vector<NodeVisitor::scope_info> &scopes) {
+  std::vector<uint32_t> order(scopes.size());
+  for (uint32_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    if (scopes[a].start != scopes[b].start)
+      return scopes[a].start < scopes[b].start;
+    return scopes[a].end > scopes[b].end;
+  });
+
+  std::vector<uint32_t> new_index(scopes.size());
+  std::vector<NodeVisitor::scope_info> sorted;
+  sorted.reserve(scopes.size());
+  // Scopes still open at the current start
+  std::vector<uint32_t> open;
+  for (auto old : order) {
+    auto &scope = scopes[old];
+    while (!open.empty() && sorted[open.back()].end < scope.start)
+      open.pop_back();
+    scope.parent = open.empty() ? NodeVisitor::no_scope : open.back();
+    new_index[old] = sorted.size();
+    open.push_back(sorted.size());
+    sorted.push_back(std::move(scope));
+  }
+  scopes = std::move(sorted);
+  return new_index;
+}
+
+void NodeVisitor::finish() {
+  for (auto &[file, scopes] : file_scopes) {
+    auto new_index = sortScopes(scopes);
+    auto symbols = known_symbols.find(file);
+    if (symbols != known_symbols.end())
+      for (auto &sym : symbols->second)
+        if (sym.scope != no_scope)
+          sym.scope = new_index[sym.scope];
+    for (auto &[name, package] : package_scopes)
+      if (package.first == file && package.second != no_scope)
+        package.second = new_index[package.second];
+    for (auto &scope : scopes)
+      sortUnique(scope.imports);
+  }
+  for (auto &[file, imports] : file_imports)
+    sortUnique(imports);
+  // Only needed while visiting
+  scope_ids.clear();
+
+  for (auto &[file, symbols] : known_symbols) {
+    // Keep the first symbol found for each name in each scope
+    std::stable_sort(symbols.begin(), symbols.end(),
+                     [](const syminfo &a, const syminfo &b) {
+                       if (a.name != b.name)
+                         return a.name < b.name;
+                       return a.scope < b.scope;
+                     });
+    auto last = std::unique(symbols.begin(), symbols.end(),
+                            [](const syminfo &a, const syminfo &b) {
+                              return a.name == b.name && a.scope == b.scope;
+                            });
+    symbols.erase(last, symbols.end());
+    symbols.shrink_to_fit();
+  }
+  for (auto &[file, scopes] : file2scopes)
+    sortUnique(scopes);
+  for (auto &[scope, types] : known_types)
+    sortUnique(types);
 }
 
 std::string NodeVisitor::getTypeName(const slang::Type &type) {
@@ -96,27 +251,31 @@ void NodeVisitor::handleScope(const slang::Type &type,
   auto &m_scope = type.getCanonicalType().as<slang::Scope>();
   // Set the name: Structs with no type get the symbol name,
   // typedefed ones get the typename
-  std::string scopename(type.name.empty() ? sym_name : type.name);
-
-  auto &memberlist = known_structs[scopename];
-  if (memberlist.size() == 0) {
-    for (auto &member : m_scope.members()) {
-      // Get the type
-      auto &member_type = member.as<slang::VariableSymbol>().getType();
-      // Fill the info struct
-      member_info m_info;
-      m_info.name = member.name;
-      m_info.kind = getKind(member_type, true);
-      m_info.type_name = getTypeName(member_type);
-      // Push it to the list
-      memberlist.emplace_back(m_info);
-      // Recurse structs
-      if (member_type.isStruct() || member_type.isClass() ||
-          member_type.isPackedUnion() || member_type.isUnpackedUnion()) {
-        handleScope(member_type, member.name);
-      }
+  auto scopename = strings.intern(type.name.empty() ? sym_name : type.name);
+
+  // Already known, or being filled by a caller
+  if (!known_structs.emplace(scopename, struct_info()).second)
+    return;
+
+  // The recursion adds to known_structs, fill a local list meanwhile
+  struct_info memberlist;
+  for (auto &member : m_scope.members()) {
+    // Get the type
+    auto &member_type = member.as<slang::VariableSymbol>().getType();
+    // Fill the info struct
+    member_info m_info;
+    m_info.name = strings.intern(member.name);
+    m_info.kind = getKind(member_type, true);
+    m_info.type_name = strings.intern(getTypeName(member_type));
+    // Push it to the list
+    memberlist.emplace_back(m_info);
+    // Recurse structs
+    if (member_type.isStruct() || member_type.isClass() ||
+        member_type.isPackedUnion() || member_type.isUnpackedUnion()) {
+      handleScope(member_type, member.name);
     }
   }
+  known_structs[scopename] = std::move(memberlist);
 }
 
 lsCompletionItemKind NodeVisitor::getKind(const slang::Type &type,
@@ -146,22 +305,23 @@ void NodeVisitor::handle_type(const slang::Type &sym) {
   if (sym.name.empty())
     return;
 
-  known_types[scopesym.name].emplace(sym.name);
+  known_types[strings.intern(scopesym.name)].push_back(
+      strings.intern(sym.name));
 }
 
 void NodeVisitor::handle_value(const slang::ValueSymbol &sym) {
   // We found a symbol!! q
-  auto fname = sm->getFileName(sym.location);
-  if (fname.empty())
+  FileId file = getFileId(sym.location);
+  if (file == FileTable::invalid)
     return;
-  auto fpath = fs::canonical(fname);
   auto def = sym.getDeclaringDefinition();
   auto &type = sym.getType();
 
   syminfo info;
+  info.name = strings.intern(sym.name);
 
   if (def != nullptr) {
-    info.parent_name = def->name;
+    info.parent_name = strings.intern(def->name);
   }
 
   // Get to the bottom of the array
@@ -176,17 +336,18 @@ void NodeVisitor::handle_value(const slang::ValueSymbol &sym) {
       subtype->isUnpackedUnion())
     handleScope(*subtype, sym.name);
 
-  info.type_name = getTypeName(type);
-  info.struct_name = subtype->name.empty() ? info.type_name : subtype->name;
+  info.type_name = strings.intern(getTypeName(type));
+  info.struct_name = subtype->name.empty() ? info.type_name
+                                           : strings.intern(subtype->name);
   info.kind = getKind(type);
+  info.scope = getScopeIndex(sym.getParentScope(), file);
 
-  known_symbols[fpath].emplace(std::make_pair(sym.name, info));
+  known_symbols[file].push_back(info);
 }
 
-const std::map<string_view, NodeVisitor::syminfo> *
-NodeVisitor::getFileSymbols(std::string_view file) {
-  std::string fname(file);
-  auto res = known_symbols.find(fname);
+const NodeVisitor::symbol_list *
+NodeVisitor::getFileSymbols(FileId file) const {
+  auto res = known_symbols.find(file);
 
   if (res != known_symbols.end()) {
     return &res->second;
@@ -194,12 +355,89 @@ NodeVisitor::getFileSymbols(std::string_view file) {
   return nullptr;
 }
 
-const std::vector<string_view> &NodeVisitor::getPackageList() {
+const NodeVisitor::syminfo *
+NodeVisitor::findSymbol(FileId file, std::string_view name,
+                        const std::vector<uint32_t> &chain) const {
+  auto symbols = getFileSymbols(file);
+  if (symbols == nullptr)
+    return nullptr;
+  auto res = std::lower_bound(symbols->begin(), symbols->end(), name,
+                              [](const syminfo &sym, std::string_view value) {
+                                return sym.name < value;
+                              });
+  if (res == symbols->end() || res->name != name)
+    return nullptr;
+
+  // The same name may be declared in several scopes, the innermost visible
+  // one hides the others
+  for (auto scope : chain)
+    for (auto it = res; it != symbols->end() && it->name == name; ++it)
+      if (it->scope == scope)
+        return &*it;
+  return &*res;
+}
+
+const std::vector<NodeVisitor::scope_info> *
+NodeVisitor::getFileScopeRanges(FileId file) const {
+  auto res = file_scopes.find(file);
+  if (res == file_scopes.end())
+    return nullptr;
+  return &res->second;
+}
+
+std::vector<uint32_t> NodeVisitor::getScopeChain(FileId file,
+                                                 uint64_t position) const {
+  std::vector<uint32_t> chain;
+  auto scopes = getFileScopeRanges(file);
+  if (scopes == nullptr)
+    return chain;
+
+  // Last scope starting before the position. It, or the first of its
+  // parents that does not end before the position, is the innermost one.
+  auto next = std::upper_bound(scopes->begin(), scopes->end(), position,
+                               [](uint64_t value, const scope_info &scope) {
+                                 return value < scope.start;
+                               });
+  uint32_t index = no_scope;
+  if (next != scopes->begin())
+    index = next - scopes->begin() - 1;
+  while (index != no_scope && (*scopes)[index].end < position)
+    index = (*scopes)[index].parent;
+
+  for (; index != no_scope; index = (*scopes)[index].parent)
+    chain.push_back(index);
+  return chain;
+}
+
+std::vector<std::string_view>
+NodeVisitor::getImports(FileId file, const std::vector<uint32_t> &chain) const {
+  std::vector<std::string_view> imports;
+  auto scopes = getFileScopeRanges(file);
+  if (scopes != nullptr)
+    for (auto scope : chain)
+      imports.insert(imports.end(), (*scopes)[scope].imports.begin(),
+                     (*scopes)[scope].imports.end());
+  auto res = file_imports.find(file);
+  if (res != file_imports.end())
+    imports.insert(imports.end(), res->second.begin(), res->second.end());
+  sortUnique(imports);
+  return imports;
+}
+
+const std::pair<FileId, uint32_t> *
+NodeVisitor::findPackage(std::string_view name) const {
+  auto res = package_scopes.find(name);
+  if (res == package_scopes.end())
+    return nullptr;
+  return &res->second;
+}
+
+const std::vector<FileId> &NodeVisitor::getPackageList() const {
   return known_packages;
 }
 
 const NodeVisitor::struct_info *
-NodeVisitor::getStructInfo(const std::string &name) {
+NodeVisitor::getStructInfo(std::string_view name) const {
   auto res = known_structs.find(name);
   if (res == known_structs.end())
     return nullptr;
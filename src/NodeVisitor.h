@@ -1,30 +1,54 @@
 #pragma once
+#include "FileTable.h"
 #include "LibLsp/lsp/lsp_completion.h"
+#include "StringPool.h"
 #include <flat_hash_map.hpp>
+#include <functional>
 #include <memory>
 #include <slang/symbols/ASTVisitor.h>
+#include <slang/symbols/MemberSymbols.h>
 #include <slang/symbols/ValueSymbol.h>
 #include <slang/text/SourceManager.h>
 #include <string_view>
 #include <vector>
-#include <set>
 
 class NodeVisitor : public slang::ASTVisitor<NodeVisitor, false, false> {
 public:
+  // Index of a scope in its file, no_scope for the file level
+  static constexpr uint32_t no_scope = ~0u;
+
+  // The strings are interned in the visitor's pool
   typedef struct {
-    std::string parent_name, type_name, struct_name;
+    std::string_view name, parent_name, type_name, struct_name;
     int arrayLevels;
     lsCompletionItemKind kind;
+    // Scope declaring the symbol
+    uint32_t scope;
   } syminfo;
 
+  // Source range of a module, function, task, block, class or package.
+  // Positions are made with makePosition, the ranges of a file nest.
+  typedef struct {
+    uint64_t start, end;
+    uint32_t parent;
+    std::string_view name;
+    // Packages imported in the scope
+    std::vector<std::string_view> imports;
+  } scope_info;
+
   typedef struct {
-    std::string name, type_name;
+    std::string_view name, type_name;
     lsCompletionItemKind kind;
   } member_info;
 
   typedef std::vector<member_info> struct_info;
+  // Symbols of a file, sorted by name
+  typedef std::vector<syminfo> symbol_list;
 
-  NodeVisitor(std::shared_ptr<slang::SourceManager> sm);
+  // The visit stops at the next instance once abandoned() is true, the
+  // results are incomplete then
+  NodeVisitor(std::shared_ptr<slang::SourceManager> sm, FileTable &files,
+              std::function<bool()> abandoned = nullptr);
 
   template <typename T> void handle(const T &t) {
     if constexpr (std::is_base_of_v<slang::ValueSymbol, T>) {
@@ -32,20 +56,46 @@ public:
     } else if constexpr (std::is_base_of_v<slang::PackageSymbol, T>) {
       handle_pkg(t);
     } else if constexpr (std::is_base_of_v<slang::InstanceSymbolBase, T>) {
+      if (abandoned && abandoned())
+        return;
       handle_instance(t);
     } else if constexpr (std::is_base_of_v<slang::Type, T>) {
       handle_type(t);
+    } else if constexpr (std::is_same_v<slang::WildcardImportSymbol, T> ||
+                         std::is_same_v<slang::ExplicitImportSymbol, T>) {
+      handle_import(t, t.packageName);
     }
 
     visitDefault(t);
   }
-  const std::map<string_view, syminfo> *getFileSymbols(std::string_view file);
-  const struct_info *getStructInfo(const std::string &name);
+  // Sort the collected symbols, must be called once the visit is done
+  void finish();
+
+  // Zero based line and byte column, ordered like the text
+  static uint64_t makePosition(size_t line, size_t column) {
+    return static_cast<uint64_t>(line) << 32 | column;
+  }
+
+  const symbol_list *getFileSymbols(FileId file) const;
+  // Prefers the symbol of the innermost scope of the chain
+  const syminfo *findSymbol(FileId file, std::string_view name,
+                            const std::vector<uint32_t> &chain = {}) const;
+  // Scopes of a file sorted by start, nullptr if the file has none
+  const std::vector<scope_info> *getFileScopeRanges(FileId file) const;
+  // Scopes containing a position, innermost first
+  std::vector<uint32_t> getScopeChain(FileId file, uint64_t position) const;
+  // Packages imported by the scopes of the chain and by the file
+  std::vector<std::string_view>
+  getImports(FileId file, const std::vector<uint32_t> &chain) const;
+  // File and scope of a package, nullptr if unknown
+  const std::pair<FileId, uint32_t> *findPackage(std::string_view name) const;
+  const struct_info *getStructInfo(std::string_view name) const;
 
-  const std::vector<string_view> &getPackageList();
+  const std::vector<FileId> &getPackageList() const;
 
-  const std::set<std::string>& getFileScopes(const fs::path& file);
-  const std::set<std::string>& getScopeTypes(std::string_view scope);
+  const std::vector<std::string_view> &getFileScopes(FileId file) const;
+  const std::vector<std::string_view> &
+  getScopeTypes(std::string_view scope) const;
 
 private:
   lsCompletionItemKind getKind(const slang::Type &type, bool isMember = false);
@@ -56,14 +106,32 @@ private:
   void handle_type(const slang::Type &sym);
   void handle_pkg(const slang::PackageSymbol &sym);
   void handle_instance(const slang::InstanceSymbolBase &unit);
+  void handle_import(const slang::Symbol &sym, std::string_view package);
+  // Index of the scope in the file, registered on first use
+  uint32_t getScopeIndex(const slang::Scope *scope, FileId file);
+  uint64_t getPosition(slang::SourceLocation location);
   std::string cleanupDecl(const std::string &decl);
+  // File of a location, looked up once per buffer
+  FileId getFileId(slang::SourceLocation location);
 
   std::shared_ptr<slang::SourceManager> sm;
-  slang::flat_hash_map<std::string, std::map<string_view, syminfo>>
-      known_symbols;
-  slang::flat_hash_map<std::string, struct_info> known_structs;
-  slang::flat_hash_map<std::string_view, std::set<std::string>> known_types;
-  slang::flat_hash_map<fs::path, std::set<std::string>> file2scopes;
-  std::vector<string_view> known_packages;
-  std::string last_toplevel;
+  FileTable &files;
+  std::function<bool()> abandoned;
+  slang::flat_hash_map<uint32_t, FileId> buffer_files;
+  StringPool strings;
+  slang::flat_hash_map<FileId, symbol_list> known_symbols;
+  slang::flat_hash_map<std::string_view, struct_info> known_structs;
+  slang::flat_hash_map<std::string_view, std::vector<std::string_view>>
+      known_types;
+  slang::flat_hash_map<FileId, std::vector<std::string_view>> file2scopes;
+  slang::flat_hash_map<FileId, std::vector<scope_info>> file_scopes;
+  // Scopes by declaration, the instances of a module share its body scope
+  slang::flat_hash_map<const slang::SyntaxNode *, std::pair<FileId, uint32_t>>
+      scope_ids;
+  // Packages imported outside of any scope
+  slang::flat_hash_map<FileId, std::vector<std::string_view>> file_imports;
+  slang::flat_hash_map<std::string_view, std::pair<FileId, uint32_t>>
+      package_scopes;
+  std::vector<FileId> known_packages;
+  const std::vector<std::string_view> empty_list;
 };
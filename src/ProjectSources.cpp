@@ -3,140 +3,527 @@
 #include "slang/compilation/Compilation.h"
 #include "slang/syntax/SyntaxTree.h"
 #include "slang/text/SourceLocation.h"
+#include <algorithm>
+#include <boost/asio/post.hpp>
 #include <filesystem>
-#include <iostream>
+#include <fmt/core.h>
+#include <fstream>
+#include <future>
+#include <iterator>
 #include <memory>
+#include <thread>
 
-ProjectSources::ProjectSources() {
+// Edited buffers are named after their file plus this revision suffix, as the
+// SourceManager does not allow assigning the same path twice
+static const std::string revision_marker = "@sver_rev";
+
+ProjectSources::ProjectSources(ServerStats &stats)
+    : stats(stats),
+      parse_pool(std::max(1u, std::thread::hardware_concurrency())) {
   config.loaded = false;
   dirty = false;
+  stale_bytes = 0;
+  revision = 0;
+
+  slang::CompilationOptions coptions;
+  coptions.lintMode = false;
+  parse_options.set(coptions);
 }
 
 void ProjectSources::setRootPath(const fs::path &path) {
+  std::lock_guard<std::mutex> lock(config_mutex);
   config.rootPath = fs::absolute(path);
   locateInitConfig(config.rootPath);
+  library_index.update(config.library_directories,
+                       config.include_directories);
 }
 
-void ProjectSources::addFile(const fs::path &file_path, bool userLoaded) {
-  auto res = files_map.find(file_path);
-  if (res == files_map.end()) {
-    file_info info;
-    info.modified = false;
-    info.userLoaded = userLoaded;
-    files_map[file_path] = info;
-  } else {
-    // We already have this file and it was user-loaded,
-    // no further processing is needed
-    if (res->second.userLoaded)
-      return;
-    // We already have this file, do the minimal modifications
-    res->second.userLoaded = userLoaded;
+void ProjectSources::rescanLibraries() {
+  std::lock_guard<std::mutex> lock(config_mutex);
+  library_index.update(config.library_directories,
+                       config.include_directories, true);
+}
+
+std::set<fs::path> ProjectSources::getWorkspaceDirectories() const {
+  std::lock_guard<std::mutex> lock(config_mutex);
+  std::set<fs::path> result = config.library_directories;
+  if (!config.rootPath.empty())
+    result.insert(config.rootPath);
+  return result;
+}
+
+void ProjectSources::addFile(FileId file, bool userLoaded) {
+  {
+    std::lock_guard<std::mutex> lock(filelist_mutex);
+    auto res = files_map.find(file);
+    if (res == files_map.end()) {
+      file_info info;
+      info.modified = false;
+      info.userLoaded = userLoaded;
+      files_map[file] = info;
+    } else {
+      // We already have this file and it was user-loaded,
+      // no further processing is needed
+      if (res->second.userLoaded)
+        return;
+      // We already have this file, do the minimal modifications
+      res->second.userLoaded = userLoaded;
+    }
+
+    // If this is auto-loaded, the compilation already has it
+    dirty |= userLoaded;
   }
 
-  dirty |= userLoaded; // If this is auto-loaded, the compilation already has it
+  // A new file may provide some of the missing library names
+  if (userLoaded)
+    library_index.clearMissing();
 
   // Try to locate a config if needed
-  if (!config.loaded)
-    locateInitConfig(file_path);
+  std::lock_guard<std::mutex> lock(config_mutex);
+  if (!config.loaded) {
+    locateInitConfig(files.getPath(file));
+    library_index.update(config.library_directories,
+                         config.include_directories);
+  }
 }
 
-void ProjectSources::addFile(const fs::path &file_path,
-                             std::string_view contents, bool userLoaded) {
-  auto res = files_map.find(file_path);
-  if (res == files_map.end()) {
-    file_info info;
-    info.content = contents;
-    info.modified = true;
-    info.userLoaded = userLoaded;
-    files_map[file_path] = info;
-  } else {
-    // We already have this file, do the minimal modifications
-    res->second.userLoaded |= userLoaded;
-    res->second.modified = true;
-    res->second.content = contents;
+void ProjectSources::addFile(FileId file, std::string_view contents,
+                             bool userLoaded) {
+  {
+    std::lock_guard<std::mutex> lock(filelist_mutex);
+    auto res = files_map.find(file);
+    if (res == files_map.end()) {
+      file_info info;
+      info.content = std::make_shared<const TextDocument>(contents);
+      info.modified = true;
+      info.userLoaded = userLoaded;
+      files_map[file] = info;
+    } else {
+      // We already have this file, do the minimal modifications
+      res->second.userLoaded |= userLoaded;
+      res->second.modified = true;
+      res->second.content = std::make_shared<const TextDocument>(contents);
+    }
+    changed_files.insert(file);
+
+    // Loading file contents always dirties the compilation
+    dirty = true;
   }
 
-  // Loading file contents always dirties the compilation
-  dirty = true;
-  if (!config.loaded)
-    locateInitConfig(file_path);
+  std::lock_guard<std::mutex> lock(config_mutex);
+  if (!config.loaded) {
+    locateInitConfig(files.getPath(file));
+    library_index.update(config.library_directories,
+                         config.include_directories);
+  }
 }
 
-void ProjectSources::modifyFile(const fs::path &file_path,
-                                std::string_view contents) {
-  auto res = files_map.find(file_path);
-  if (res == files_map.end()) {
-
-  } else {
-    // We do have it
-    res->second.content = contents;
-    res->second.modified = true;
-    dirty = true;
+void ProjectSources::modifyFile(
+    FileId file, const std::vector<lsTextDocumentContentChangeEvent> &changes) {
+  std::lock_guard<std::mutex> lock(filelist_mutex);
+  auto res = files_map.find(file);
+  // Changes can only be applied on top of the contents sent on didOpen
+  if (res == files_map.end() || res->second.content == nullptr)
+    return;
+
+  // Copy on write, a compilation may be reading the current document
+  auto doc = std::make_shared<TextDocument>(*res->second.content);
+  for (auto &change : changes) {
+    if (change.range.has_value()) {
+      auto &range = change.range.value();
+      doc->applyChange(range.start.line, range.start.character,
+                       range.end.line, range.end.character, change.text);
+    } else {
+      doc->setText(change.text);
+    }
   }
+  res->second.content = doc;
+  res->second.modified = true;
+  changed_files.insert(file);
+  dirty = true;
 }
 
-std::shared_ptr<slang::SourceManager> ProjectSources::getSourceManager() {
-  return sm;
+fs::path ProjectSources::getBufferPath(std::string_view buffer_name) {
+  auto pos = buffer_name.rfind(revision_marker);
+  if (pos == std::string_view::npos)
+    return fs::path(buffer_name);
+  return fs::path(buffer_name.substr(0, pos));
 }
 
-const std::string_view ProjectSources::getFileContents(const fs::path &fpath) {
+const std::string ProjectSources::getFileLine(FileId file, int line) {
+  std::lock_guard<std::mutex> lock(filelist_mutex);
   // Try to find it in the locally modified files
-  auto res_f = files_map.find(fpath);
+  auto res_f = files_map.find(file);
   if (res_f != files_map.end()) {
-    if (res_f->second.modified) {
-      auto &content = res_f->second.content;
-      return content;
+    if (res_f->second.modified && res_f->second.content) {
+      return res_f->second.content->getLine(line);
     }
   }
   // If not, search for it in the compilation
-  auto res = loadedBuffers.find(fpath);
-  if (res != loadedBuffers.end()) {
-    auto mview = res->second.data;
-    return mview;
-  }
+  auto res = loadedBuffers.find(file);
+  if (res != loadedBuffers.end())
+    return std::string(res->second.lines->getLine(line));
   return "";
 }
 
-std::shared_ptr<slang::Compilation> ProjectSources::compile() {
-  slang::CompilationOptions coptions;
-  slang::Bag options;
-  coptions.lintMode = false;
-  options.set(coptions);
+ProjectSources::parsed_file ProjectSources::getSyntaxTree(FileId file) {
+  file_info info;
+  {
+    std::lock_guard<std::mutex> lock(filelist_mutex);
+    auto res_f = files_map.find(file);
+    if (res_f == files_map.end())
+      return {};
+    info = res_f->second;
+    auto loaded = loadedBuffers.find(file);
+    if (loaded != loadedBuffers.end() && loaded->second.tree != nullptr) {
+      uint64_t current =
+          info.modified && info.content ? info.content->getRevision() : 0;
+      if (loaded->second.revision == current)
+        return {sm, loaded->second.tree, loaded->second.lines};
+    }
+  }
 
-  std::shared_ptr<slang::Compilation> compilation(
-      new slang::Compilation(options));
+  // Not compiled yet, or edited since: parse it apart from the compilations
+  parsed_file res;
+  res.sm = std::make_shared<slang::SourceManager>();
+  auto path = files.getPath(file);
+  slang::SourceBuffer buffer;
+  if (info.modified && info.content)
+    buffer = res.sm->assignBuffer(path.string(), info.content->materialize());
+  else
+    buffer = res.sm->readSource(path.string());
+  if (!buffer)
+    return {};
+  res.lines = std::make_shared<const LineIndex>(buffer.data);
+  res.tree = slang::SyntaxTree::fromBuffer(buffer, *res.sm, parse_options);
+  return res;
+}
 
-  std::cerr << "Re-compiling sources" << std::endl;
+std::shared_ptr<const LineIndex>
+ProjectSources::getLineIndex(FileId file, std::string_view text) const {
+  std::lock_guard<std::mutex> lock(filelist_mutex);
+  auto res = loadedBuffers.find(file);
+  if (res == loadedBuffers.end())
+    return nullptr;
+  // Same buffer, not an older or newer revision of the file
+  auto indexed = res->second.lines->getText();
+  if (indexed.data() != text.data() || indexed.size() != text.size())
+    return nullptr;
+  return res->second.lines;
+}
 
-  // Recreate SourceManager
-  // Since it does not acept modifying files, we have to do this for every
-  // compilation
-  if (sm != nullptr) {
-    sm.reset();
+void ProjectSources::resetSourceManager(
+    const std::set<fs::path> &include_directories) {
+  {
+    // getSyntaxTree() hands out the SourceManager with the loaded trees
+    std::lock_guard<std::mutex> lock(filelist_mutex);
+    sm = std::make_shared<slang::SourceManager>();
     loadedBuffers.clear();
   }
-  sm = std::make_shared<slang::SourceManager>();
-
-  // Add the user include directories to the SM
-  for (auto &dpath : config.include_directories) {
+  parse_cache.clear();
+  header_stamps.clear();
+  stale_bytes = 0;
+
+  // Add the user include directories to the SM, skipping the empty ones
+  // since slang probes every directory for each include
+  sm_include_directories = include_directories;
+  sm_user_directories = library_index.getIncludeDirectories();
+  for (auto &dpath : sm_user_directories) {
     sm->addUserDirectory(dpath.string());
   }
+  assignEditedHeaders();
+}
+
+void ProjectSources::assignEditedHeaders() {
+  header_revisions.clear();
+  for (auto &[path, file] : headers) {
+    std::shared_ptr<const TextDocument> doc;
+    {
+      std::lock_guard<std::mutex> lock(filelist_mutex);
+      auto res = files_map.find(file);
+      if (res == files_map.end() || !res->second.modified)
+        continue;
+      doc = res->second.content;
+    }
+    if (doc == nullptr)
+      continue;
+    sm->assignBuffer(path.string(), doc->materialize());
+    header_revisions[path] = doc->getRevision();
+  }
+}
+
+bool ProjectSources::parseFiles(std::vector<parse_job> &jobs,
+                                const std::function<bool()> &abandoned) {
+  std::vector<std::future<void>> pending;
+
+  for (auto &job : jobs) {
+    auto cached = parse_cache.find(job.file);
+    bool found = cached != parse_cache.end();
+
+    if (!job.info.modified) {
+      // Files not open in the editor can still change on disk, through a
+      // checkout or a generator
+      job.stamp = getDiskStamp(job.path);
+      if (found && cached->second.stamp == job.stamp) {
+        job.tree = cached->second.tree;
+        continue;
+      }
+      if (found) {
+        // Read apart, the SourceManager keeps the first contents of a path
+        std::ifstream in(job.path, std::ios::binary);
+        if (!in)
+          continue;
+        job.text.assign(std::istreambuf_iterator<char>(in), {});
+        job.hash = std::hash<std::string_view>{}(
+            std::string_view(job.text.data(), job.text.size()));
+        job.text.push_back('\0');
+        // Only touched, such as by a checkout of the same contents
+        if (cached->second.hash == job.hash) {
+          cached->second.stamp = job.stamp;
+          job.tree = cached->second.tree;
+          continue;
+        }
+        job.buffer_name = fmt::format("{}{}{}", job.path.string(),
+                                      revision_marker, ++revision);
+      }
+    } else {
+      auto &doc = *job.info.content;
+      // Unchanged document, or a change that restored the parsed contents
+      if (found && cached->second.revision == doc.getRevision()) {
+        job.tree = cached->second.tree;
+        continue;
+      }
+      // Hash without the null terminator, as for the buffers read from disk
+      job.text = doc.materialize();
+      job.hash = std::hash<std::string_view>{}(
+          std::string_view(job.text.data(), job.text.size() - 1));
+      if (found && cached->second.hash == job.hash) {
+        cached->second.revision = doc.getRevision();
+        job.tree = cached->second.tree;
+        std::lock_guard<std::mutex> lock(filelist_mutex);
+        auto loaded = loadedBuffers.find(job.file);
+        if (loaded != loadedBuffers.end())
+          loaded->second.revision = doc.getRevision();
+        continue;
+      }
+
+      // Revisions are numbered here to keep them in order
+      job.buffer_name = fmt::format("{}{}{}", job.path.string(),
+                                    revision_marker, ++revision);
+    }
+
+    auto task = std::make_shared<std::packaged_task<void()>>(
+        [this, &job, &abandoned]() {
+          if (abandoned && abandoned())
+            return;
+          TraceWriter::setThreadName("parse");
+          {
+            ServerStats::scoped_phase phase(stats, ServerStats::phase_load,
+                                            job.path.string());
+            if (!job.buffer_name.empty()) {
+              // Hand the materialized text to slang without copying it
+              job.buffer =
+                  sm->assignBuffer(job.buffer_name, std::move(job.text));
+            } else {
+              job.buffer = sm->readSource(job.path.string());
+              job.hash = std::hash<std::string_view>{}(job.buffer.data);
+            }
+            if (!job.buffer)
+              return;
+            job.lines = std::make_shared<const LineIndex>(job.buffer.data);
+          }
+          ServerStats::scoped_phase phase(stats, ServerStats::phase_parse,
+                                          job.path.string());
+          job.tree =
+              slang::SyntaxTree::fromBuffer(job.buffer, *sm, parse_options);
+        });
+    pending.push_back(task->get_future());
+    boost::asio::post(parse_pool, [task]() { (*task)(); });
+  }
+
+  for (auto &res : pending)
+    res.get();
+
+  // Store the new trees. Even if abandoned, the next compilation can use them
+  for (auto &job : jobs) {
+    if (!job.buffer || job.tree == nullptr)
+      continue;
+
+    auto cached = parse_cache.find(job.file);
+    // The old buffer stays in the SourceManager until it is recreated
+    if (cached != parse_cache.end())
+      stale_bytes += cached->second.buffer.data.size();
+    uint64_t doc_revision =
+        job.info.modified ? job.info.content->getRevision() : 0;
+    parse_cache[job.file] = {job.hash,   doc_revision, job.stamp,
+                             job.buffer, job.lines,    job.tree};
+
+    std::lock_guard<std::mutex> lock(filelist_mutex);
+    loadedBuffers[job.file] = {job.buffer, job.lines, job.tree, doc_revision};
+  }
+
+  recordHeaders();
+  return !(abandoned && abandoned());
+}
+
+void ProjectSources::recordHeaders() {
+  for (auto buffer : sm->getAllBuffers()) {
+    if (!sm->getIncludedFrom(buffer).valid())
+      continue;
+    auto path = sm->getFullPath(buffer);
+    if (!headers.count(path))
+      headers.emplace(path, files.getId(path));
+    // The ones from the editor do not depend on the disk
+    if (!header_stamps.count(path) && !header_revisions.count(path))
+      header_stamps.emplace(path, getDiskStamp(path));
+  }
+}
+
+bool ProjectSources::headersChanged() {
+  for (auto &[path, file] : headers) {
+    uint64_t edited = 0;
+    {
+      std::lock_guard<std::mutex> lock(filelist_mutex);
+      auto res = files_map.find(file);
+      if (res != files_map.end() && res->second.modified &&
+          res->second.content != nullptr)
+        edited = res->second.content->getRevision();
+    }
+    auto assigned = header_revisions.find(path);
+    if (edited != (assigned != header_revisions.end() ? assigned->second : 0))
+      return true;
+  }
+  for (auto &[path, stamp] : header_stamps) {
+    if (getDiskStamp(path) != stamp)
+      return true;
+  }
+  return false;
+}
+
+ProjectSources::disk_stamp ProjectSources::getDiskStamp(const fs::path &path) {
+  // A missing file gets an empty stamp
+  std::error_code ec;
+  disk_stamp res;
+  res.mtime = fs::last_write_time(path, ec);
+  if (ec)
+    return {};
+  res.size = fs::file_size(path, ec);
+  return res;
+}
+
+// Must be called with compilation_mutex locked
+void ProjectSources::prepareSourceManager() {
+  std::set<fs::path> include_directories, library_directories;
+  {
+    std::lock_guard<std::mutex> lock(config_mutex);
+    include_directories = config.include_directories;
+    library_directories = config.library_directories;
+  }
+  // No-op unless the directories changed since the last indexing
+  library_index.update(library_directories, include_directories);
+
+  // The SourceManager is kept between compilations so that the SyntaxTrees of
+  // unchanged files can be reused. It does not allow removing buffers, so it
+  // is recreated when the stale ones take too much memory, when the include
+  // directories change or get their first files, or when an included header
+  // changes.
+  if (sm == nullptr || stale_bytes > max_stale_bytes ||
+      sm_include_directories != include_directories ||
+      sm_user_directories != library_index.getIncludeDirectories() ||
+      headersChanged())
+    resetSourceManager(include_directories);
+}
+
+std::vector<std::pair<FileId, std::shared_ptr<slang::SyntaxTree>>>
+ProjectSources::parseChangedFiles(
+    std::shared_ptr<slang::SourceManager> &parse_sm,
+    const std::function<bool()> &abandoned) {
+  std::lock_guard<std::mutex> compilation_lock(compilation_mutex);
+
+  std::vector<parse_job> jobs;
+  {
+    std::lock_guard<std::mutex> lock(filelist_mutex);
+    for (auto file : changed_files) {
+      auto res = files_map.find(file);
+      if (res != files_map.end())
+        jobs.push_back({file, files.getPath(file), res->second});
+    }
+    changed_files.clear();
+  }
+
+  prepareSourceManager();
+  parse_sm = sm;
+
+  if (!parseFiles(jobs, abandoned)) {
+    // Keep them for the next time
+    std::lock_guard<std::mutex> lock(filelist_mutex);
+    for (auto &job : jobs)
+      changed_files.insert(job.file);
+    return {};
+  }
 
-  // Parse and compile all the known files
-  // Lock the filelist while we are using it
-  for (auto &&[filepath, info] : files_map) {
-    slang::SourceBuffer buff;
-    if (info.modified)
-      buff = sm->assignText(filepath.string(), info.content);
-    else
-      buff = sm->readSource(filepath.string());
-    loadedBuffers[filepath] = buff;
-    auto tree = slang::SyntaxTree::fromBuffer(buff, *sm, options);
-    if (!info.userLoaded)
-      tree->isLibrary = true;
-    compilation->addSyntaxTree(tree);
+  std::vector<std::pair<FileId, std::shared_ptr<slang::SyntaxTree>>> result;
+  for (auto &job : jobs) {
+    if (job.tree != nullptr)
+      result.emplace_back(job.file, job.tree);
+  }
+  return result;
+}
+
+std::shared_ptr<slang::Compilation>
+ProjectSources::compile(std::shared_ptr<slang::SourceManager> &compile_sm,
+                        const std::function<bool()> &abandoned) {
+  std::lock_guard<std::mutex> compilation_lock(compilation_mutex);
+  std::shared_ptr<slang::Compilation> compilation(
+      new slang::Compilation(parse_options));
+
+  // Work on a copy of the filelist, so that it can be modified meanwhile
+  std::map<FileId, file_info> file_list;
+  {
+    std::lock_guard<std::mutex> lock(filelist_mutex);
+    file_list = files_map;
+    dirty = false;
+  }
+
+  prepareSourceManager();
+  compile_sm = sm;
+
+  // Parse (or reuse) all the known files
+  std::vector<parse_job> jobs;
+  for (auto &&[file, info] : file_list)
+    jobs.push_back({file, files.getPath(file), info});
+  if (!parseFiles(jobs, abandoned))
+    return nullptr;
+
+  // Headers included for the first time may be edited in the editor, then
+  // the files are parsed again with their text
+  if (headersChanged()) {
+    prepareSourceManager();
+    compile_sm = sm;
+    jobs.clear();
+    for (auto &&[file, info] : file_list)
+      jobs.push_back({file, files.getPath(file), info});
+    if (!parseFiles(jobs, abandoned))
+      return nullptr;
   }
 
+  // Add them in the filelist order, so the compilation is deterministic
+  std::map<FileId, std::shared_ptr<slang::SyntaxTree>> trees;
+  std::map<FileId, uint64_t> revisions;
+  for (auto &job : jobs) {
+    if (job.tree == nullptr)
+      continue;
+    job.tree->isLibrary = !job.info.userLoaded;
+    compilation->addSyntaxTree(job.tree);
+    trees[job.file] = job.tree;
+    if (job.info.modified && job.info.content)
+      revisions[job.file] = job.info.content->getRevision();
+  }
+
+  // Until the end, load the missing modules and packages from the libraries
+  ServerStats::scoped_phase libraries_phase(stats,
+                                            ServerStats::phase_libraries);
+
   /* ********************************************************************
    * Code from slang/tools/driver/driver.cpp to find the names of missing
    * packages
@@ -189,42 +576,53 @@ std::shared_ptr<slang::Compilation> ProjectSources::compile() {
     findMissingNames(tree, missingNames);
   /************* END OF SLANG CODE***************/
 
-  std::vector<std::string> extensions = {"v", "sv"};
+  auto locateLibraryFile = [&](string_view name) -> fs::path {
+    auto path = library_index.findLibraryFile(name);
+    if (path.empty() || sm->isCached(path))
+      return {};
+    return path;
+  };
 
   // Loop modified from original slang code
   // Keep loading new files as long as we are making forward progress.
   slang::flat_hash_set<string_view> nextMissingNames;
+  std::set<FileId> found;
   while (true) {
-    for (auto name : missingNames) {
-      slang::SourceBuffer buffer;
-      for (auto &dir : config.library_directories) {
-        fs::path path = dir / name;
-
-        for (auto &ext : extensions) {
-          path.replace_extension(ext);
-          if (!sm->isCached(path)) {
-            buffer = sm->readSource(path);
-            if (buffer) {
-              // Add to the local filelist to ease future loading
-              addFile(path, false);
-              break;
-            }
-          }
-        }
+    // Sort the names, the set order would make the compilation random
+    std::vector<string_view> names(missingNames.begin(), missingNames.end());
+    std::sort(names.begin(), names.end());
+
+    std::vector<parse_job> lib_jobs;
+    for (auto name : names) {
+      auto path = locateLibraryFile(name);
+      if (path.empty())
+        continue;
+      FileId file = files.getId(path);
+      if (file_list.count(file) || !found.insert(file).second)
+        continue;
+
+      // Add to the local filelist to ease future loading
+      addFile(file, false);
+      file_info info;
+      info.modified = false;
+      info.userLoaded = false;
+      lib_jobs.push_back({file, files.getPath(file), info});
+    }
 
-        if (buffer)
-          break;
-      }
+    // Parse the whole batch of library files at once
+    if (!parseFiles(lib_jobs, abandoned))
+      return nullptr;
 
-      if (buffer) {
-        auto tree = slang::SyntaxTree::fromBuffer(buffer, *sm, options);
-        tree->isLibrary = true;
-        compilation->addSyntaxTree(tree);
+    for (auto &job : lib_jobs) {
+      if (job.tree == nullptr)
+        continue;
+      job.tree->isLibrary = true;
+      compilation->addSyntaxTree(job.tree);
+      trees[job.file] = job.tree;
 
-        // Re-calculate the missing names
-        addKnownNames(tree);
-        findMissingNames(tree, nextMissingNames);
-      }
+      // Re-calculate the missing names
+      addKnownNames(job.tree);
+      findMissingNames(job.tree, nextMissingNames);
     }
 
     if (nextMissingNames.empty())
@@ -234,18 +632,42 @@ std::shared_ptr<slang::Compilation> ProjectSources::compile() {
     nextMissingNames.clear();
   }
 
+  compiled_trees = std::move(trees);
+  compiled_revisions = std::move(revisions);
   return compilation;
 }
 
-const std::vector<fs::path> ProjectSources::getUserFiles() const {
-  std::vector<fs::path> result;
-  for (auto &&[filepath, info] : files_map) {
+std::map<FileId, std::shared_ptr<slang::SyntaxTree>>
+ProjectSources::getCompiledTrees() const {
+  std::lock_guard<std::mutex> lock(compilation_mutex);
+  return compiled_trees;
+}
+
+std::map<FileId, uint64_t> ProjectSources::getCompiledRevisions() const {
+  std::lock_guard<std::mutex> lock(compilation_mutex);
+  return compiled_revisions;
+}
+
+uint64_t ProjectSources::getRevision(FileId file) const {
+  std::lock_guard<std::mutex> lock(filelist_mutex);
+  auto res = files_map.find(file);
+  if (res == files_map.end() || !res->second.modified ||
+      res->second.content == nullptr)
+    return 0;
+  return res->second.content->getRevision();
+}
+
+const std::vector<FileId> ProjectSources::getUserFiles() const {
+  std::lock_guard<std::mutex> lock(filelist_mutex);
+  std::vector<FileId> result;
+  for (auto &&[file, info] : files_map) {
     if (info.userLoaded)
-      result.push_back(filepath);
+      result.push_back(file);
   }
   return result;
 }
 
+// Must be called with config_mutex locked
 void ProjectSources::locateInitConfig(fs::path base) {
   // If given a file, get the directory
   if (!fs::is_directory(base)) {
@@ -301,6 +723,7 @@ void ProjectSources::locateInitConfig(fs::path base) {
 }
 
 void ProjectSources::setConfig(ServerConfig newConfig) {
+  std::unique_lock<std::mutex> lock(config_mutex);
   config.loaded = true;
   // Load configuration, will overwrite any existing one
 
@@ -322,11 +745,16 @@ void ProjectSources::setConfig(ServerConfig newConfig) {
     config.library_directories.insert(fs::absolute(p));
   }
 
+  // Index the directories in the background, the same ones may have new
+  // files
+  library_index.update(config.library_directories,
+                       config.include_directories, true);
+  lock.unlock();
+
   // Add Extra files to the compilation
   for (std::string p : newConfig.compileFiles) {
     if (!fs::exists(p))
       continue;
-    auto newdir = fs::absolute(p);
-    addFile(newdir, false);
+    addFile(files.getId(p), false);
   }
 }
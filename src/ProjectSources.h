@@ -1,16 +1,25 @@
 #pragma once
 #include "LibLsp/lsp/AbsolutePath.h"
+#include "LibLsp/lsp/textDocument/did_change.h"
+#include "FileTable.h"
+#include "LibraryIndex.h"
+#include "LineIndex.h"
 #include "ServerConfig.h"
+#include "ServerStats.h"
+#include "TextDocument.h"
 #include "slang/text/SourceManager.h"
+#include <boost/asio/thread_pool.hpp>
 #include <filesystem>
+#include <functional>
 #include <mutex>
 #include <set>
 #include <slang/compilation/Compilation.h>
+#include <slang/syntax/SyntaxTree.h>
 #include <string>
 
 class ProjectSources {
   struct file_info {
-    std::string content;
+    std::shared_ptr<const TextDocument> content;
     bool modified;
     bool userLoaded;
   };
@@ -22,27 +31,158 @@ class ProjectSources {
     std::set<fs::path> include_directories;
   };
 
+  // Size and modification time of a file on disk, to notice its changes
+  struct disk_stamp {
+    fs::file_time_type mtime;
+    uintmax_t size = 0;
+    bool operator==(const disk_stamp &other) const {
+      return mtime == other.mtime && size == other.size;
+    }
+    bool operator!=(const disk_stamp &other) const {
+      return !(*this == other);
+    }
+  };
+
+  // Parsed state of a file, reused while its contents do not change
+  struct parse_entry {
+    size_t hash;
+    uint64_t revision;
+    // Of the file on disk, when it was not open in the editor
+    disk_stamp stamp;
+    slang::SourceBuffer buffer;
+    std::shared_ptr<const LineIndex> lines;
+    std::shared_ptr<slang::SyntaxTree> tree;
+  };
+
+  // Last buffer loaded for a file, with its line index and syntax tree
+  struct loaded_buffer {
+    slang::SourceBuffer buffer;
+    std::shared_ptr<const LineIndex> lines;
+    std::shared_ptr<slang::SyntaxTree> tree;
+    // Revision of the document it was parsed from, 0 if read from disk
+    uint64_t revision;
+  };
+
+  // A file to be parsed (or reused from the cache) in a compilation
+  struct parse_job {
+    FileId file;
+    fs::path path;
+    file_info info;
+    std::string buffer_name;
+    std::vector<char> text;
+    size_t hash;
+    disk_stamp stamp;
+    slang::SourceBuffer buffer;
+    std::shared_ptr<const LineIndex> lines;
+    std::shared_ptr<slang::SyntaxTree> tree;
+  };
+
 public:
-  ProjectSources();
-  void addFile(const fs::path &file_path, bool user_loaded = true);
-  void addFile(const fs::path &file_path, std::string_view contents,
-               bool user_loaded = true);
-  void modifyFile(const fs::path &file_path, std::string_view contents);
-  std::shared_ptr<slang::Compilation> compile();
-  std::shared_ptr<slang::SourceManager> getSourceManager();
+  // Syntax tree of a file, with the SourceManager and line index of its buffer
+  struct parsed_file {
+    std::shared_ptr<slang::SourceManager> sm;
+    std::shared_ptr<slang::SyntaxTree> tree;
+    std::shared_ptr<const LineIndex> lines;
+  };
+
+  // The loading, parsing and library resolution are timed in stats
+  explicit ProjectSources(ServerStats &stats);
+  void addFile(FileId file, bool user_loaded = true);
+  void addFile(FileId file, std::string_view contents, bool user_loaded = true);
+  void modifyFile(FileId file,
+                  const std::vector<lsTextDocumentContentChangeEvent> &changes);
+  // Compile all the known files. If abandoned() becomes true while compiling,
+  // the compilation is stopped and nullptr is returned.
+  // compile_sm is set to the SourceManager used by the compilation.
+  std::shared_ptr<slang::Compilation>
+  compile(std::shared_ptr<slang::SourceManager> &compile_sm,
+          const std::function<bool()> &abandoned = nullptr);
+  // Parse only the files edited since the last call, for quick syntax checks
+  std::vector<std::pair<FileId, std::shared_ptr<slang::SyntaxTree>>>
+  parseChangedFiles(std::shared_ptr<slang::SourceManager> &parse_sm,
+                    const std::function<bool()> &abandoned = nullptr);
   void setRootPath(const fs::path &path);
   void setConfig(ServerConfig config);
+  // List the library and include directories again, files may have been
+  // created in them
+  void rescanLibraries();
+  // Root path and library directories, where the design sources are
+  std::set<fs::path> getWorkspaceDirectories() const;
+
+  const std::vector<FileId> getUserFiles() const;
+  // Syntax trees of the files in the last finished compilation. A tree is
+  // shared between compilations while its file does not change.
+  std::map<FileId, std::shared_ptr<slang::SyntaxTree>> getCompiledTrees() const;
+  // Document revision of each file in the last finished compilation, the
+  // files read from disk are left out
+  std::map<FileId, uint64_t> getCompiledRevisions() const;
+  // Current document revision of a file, 0 if it is not edited
+  uint64_t getRevision(FileId file) const;
+
+  // Syntax tree of the current contents of a file, without compiling. The
+  // tree of the last compilation is reused if the file did not change since,
+  // otherwise the file is parsed on its own. Empty if it cannot be read.
+  parsed_file getSyntaxTree(FileId file);
 
-  const std::vector<fs::path> getUserFiles() const;
+  const std::string getFileLine(FileId file, int line);
+  // Line index of the last loaded buffer of a file, nullptr if text is not
+  // the contents of that buffer
+  std::shared_ptr<const LineIndex> getLineIndex(FileId file,
+                                                std::string_view text) const;
 
-  const std::string_view getFileContents(const fs::path &fpath);
+  // Identities of all the files known to the server
+  FileTable &getFiles() { return files; }
+  const FileTable &getFiles() const { return files; }
+
+  // Get the real path of a file from the name of one of its buffers
+  static fs::path getBufferPath(std::string_view buffer_name);
 
 private:
   void locateInitConfig(fs::path base);
+  void prepareSourceManager();
+  void resetSourceManager(const std::set<fs::path> &include_directories);
+  // Parse the files not found in the cache on the thread pool.
+  // Returns false if the compilation was abandoned meanwhile.
+  bool parseFiles(std::vector<parse_job> &jobs,
+                  const std::function<bool()> &abandoned);
+  // Remember the headers included by the parsed files, and tell if one of
+  // them changed on disk or in the editor since. The SourceManager keeps the
+  // first contents it has for a header, so it has to be recreated then.
+  void recordHeaders();
+  bool headersChanged();
+  // Give a new SourceManager the editor text of the known headers, under
+  // their own path so the includes find it
+  void assignEditedHeaders();
+  static disk_stamp getDiskStamp(const fs::path &path);
+
+  // Superseded buffers that can be kept in the SourceManager before it gets
+  // recreated from scratch
+  static constexpr size_t max_stale_bytes = 64 * 1024 * 1024;
+
+  ServerStats &stats;
   bool dirty;
   init_config config;
   std::shared_ptr<slang::SourceManager> sm;
-  std::map<fs::path, file_info> files_map;
-  std::map<fs::path, slang::SourceBuffer> loadedBuffers;
-  std::mutex compilation_mutex, filelist_mutex, config_mutex;
+  FileTable files;
+  std::map<FileId, file_info> files_map;
+  std::set<FileId> changed_files;
+  std::map<FileId, loaded_buffer> loadedBuffers;
+  std::map<FileId, parse_entry> parse_cache;
+  std::map<fs::path, disk_stamp> header_stamps;
+  // Headers ever included by the parsed files, kept when the SourceManager
+  // is recreated
+  std::map<fs::path, FileId> headers;
+  // Document revision of the headers assigned from the editor
+  std::map<fs::path, uint64_t> header_revisions;
+  std::map<FileId, std::shared_ptr<slang::SyntaxTree>> compiled_trees;
+  std::map<FileId, uint64_t> compiled_revisions;
+  std::set<fs::path> sm_include_directories;
+  // Non-empty include directories given to the SourceManager
+  std::vector<fs::path> sm_user_directories;
+  size_t stale_bytes;
+  unsigned revision;
+  slang::Bag parse_options;
+  boost::asio::thread_pool parse_pool;
+  LibraryIndex library_index;
+  mutable std::mutex compilation_mutex, filelist_mutex, config_mutex;
 };
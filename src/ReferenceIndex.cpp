@@ -0,0 +1,456 @@
+#include "ReferenceIndex.h"
+#include <algorithm>
+#include <numeric>
+#include <slang/symbols/ASTVisitor.h>
+#include <slang/syntax/AllSyntax.h>
+#include <slang/text/SourceManager.h>
+#include <variant>
+
+class ReferenceVisitor
+    : public slang::ASTVisitor<ReferenceVisitor, true, true> {
+public:
+  typedef ReferenceIndex::decl_ref decl_ref;
+
+  ReferenceVisitor(ReferenceIndex &index, SourcePositions &positions,
+                   const slang::SourceManager &sm,
+                   std::map<FileId, ReferenceIndex::file_index> &building,
+                   const std::function<bool()> &abandoned)
+      : index(index), positions(positions), sm(sm), building(building),
+        abandoned(abandoned) {}
+
+  template <typename T> void handle(const T &t) {
+    if constexpr (std::is_same_v<slang::InstanceSymbol, T>) {
+      if (abandoned && abandoned())
+        return;
+    }
+    if constexpr (std::is_same_v<slang::NamedValueExpression, T> ||
+                  std::is_same_v<slang::HierarchicalValueExpression, T>) {
+      addReference(t.symbol, t.sourceRange);
+    } else if constexpr (std::is_same_v<slang::MemberAccessExpression, T>) {
+      addReference(t.member, t.sourceRange);
+    } else if constexpr (std::is_same_v<slang::CallExpression, T>) {
+      handle_call(t);
+    } else if constexpr (std::is_base_of_v<slang::Symbol, T>) {
+      // The name of the declaration refers to itself
+      auto decl = getDeclaration(t);
+      auto target = decl.valid() ? getBuilding(decl.file) : nullptr;
+      if (target != nullptr) {
+        auto &range = target->declarations[decl.index].range;
+        target->occurrences.push_back({ReferenceIndex::makeKey(range.start),
+                                       ReferenceIndex::makeKey(range.end),
+                                       decl});
+      }
+      if constexpr (std::is_base_of_v<slang::ValueSymbol, T>)
+        handle_value(t);
+      if constexpr (std::is_same_v<slang::InstanceSymbol, T>)
+        handle_instance(t);
+    }
+
+    visitDefault(t);
+  }
+
+private:
+  // Index being built for a file, nullptr if the previous one is reused
+  ReferenceIndex::file_index *getBuilding(FileId file) {
+    auto res = building.find(file);
+    if (res != building.end())
+      return &res->second;
+    if (index.files.count(file))
+      return nullptr;
+    return &building[file];
+  }
+
+  decl_ref getDeclaration(const slang::Symbol &sym) {
+    if (sym.name.empty() || !sym.location)
+      return {};
+    auto file_location = sm.getFullyOriginalLoc(sym.location);
+    uint64_t key =
+        static_cast<uint64_t>(file_location.buffer().getId()) << 32 |
+        file_location.offset();
+    auto res = known.find(key);
+    if (res != known.end())
+      return res->second;
+
+    decl_ref decl{};
+    FileId file = positions.getFile(sym.location);
+    if (file == FileTable::invalid) {
+      known.emplace(key, decl);
+      return decl;
+    }
+    lsRange range;
+    range.start = positions.getPosition(sym.location);
+    range.end = range.start;
+    range.end.character +=
+        static_cast<int>(LineIndex::utf16Length(sym.name));
+
+    auto target = getBuilding(file);
+    if (target == nullptr) {
+      // Declared in a reused file, it keeps its number
+      decl = index.findDeclaration(file, range.start);
+      known.emplace(key, decl);
+      return decl;
+    }
+    decl = {file, static_cast<uint32_t>(target->declarations.size())};
+    target->declarations.push_back({range, {}});
+    known.emplace(key, decl);
+
+    // Added after, the type declaration may push to the list
+    if (sym.isValue()) {
+      auto type = getTypeDeclaration(sym.as<slang::ValueSymbol>().getType());
+      getBuilding(file)->declarations[decl.index].type = type;
+    }
+    return decl;
+  }
+
+  // Declaration of a type, looking through the arrays
+  decl_ref getTypeDeclaration(const slang::Type &type) {
+    const slang::Type *base = &type;
+    while (base->isArray() && base->getArrayElementType() != nullptr)
+      base = base->getArrayElementType();
+    return getDeclaration(*base);
+  }
+
+  // The name is at the end of the range, after the hierarchy or the object
+  void addReference(const slang::Symbol &sym, slang::SourceRange range) {
+    FileId file = positions.getFile(range.end());
+    if (file == FileTable::invalid)
+      return;
+    auto target = getBuilding(file);
+    if (target == nullptr)
+      return;
+    auto decl = getDeclaration(sym);
+    if (!decl.valid())
+      return;
+
+    auto end = positions.getPosition(range.end());
+    auto start = end;
+    start.character -=
+        std::min(end.character,
+                 static_cast<int>(LineIndex::utf16Length(sym.name)));
+    target->occurrences.push_back(
+        {ReferenceIndex::makeKey(start), ReferenceIndex::makeKey(end), decl});
+  }
+
+  void handle_call(const slang::CallExpression &call) {
+    if (call.isSystemCall() || call.syntax == nullptr)
+      return;
+    auto sub = std::get<0>(call.subroutine);
+    if (sub == nullptr)
+      return;
+    // Calls without arguments may have no parenthesis
+    auto range = call.syntax->sourceRange();
+    if (call.syntax->kind == slang::SyntaxKind::InvocationExpression)
+      range = call.syntax->as<slang::InvocationExpressionSyntax>()
+                  .left->sourceRange();
+    addReference(*sub, range);
+  }
+
+  // Named types used in the declaration
+  void handle_value(const slang::ValueSymbol &sym) {
+    auto declared = sym.getDeclaredType();
+    if (declared == nullptr)
+      return;
+    auto syntax = declared->getTypeSyntax();
+    if (syntax == nullptr || syntax->kind != slang::SyntaxKind::NamedType)
+      return;
+    addReference(sym.getType(), syntax->sourceRange());
+  }
+
+  // Module name of an instantiation
+  void handle_instance(const slang::InstanceSymbol &inst) {
+    auto syntax = inst.getSyntax();
+    if (syntax == nullptr || syntax->parent == nullptr ||
+        syntax->parent->kind != slang::SyntaxKind::HierarchyInstantiation)
+      return;
+    auto &type =
+        syntax->parent->as<slang::HierarchyInstantiationSyntax>().type;
+    addReference(inst.getDefinition(), type.range());
+  }
+
+  ReferenceIndex &index;
+  SourcePositions &positions;
+  const slang::SourceManager &sm;
+  std::map<FileId, ReferenceIndex::file_index> &building;
+  const std::function<bool()> &abandoned;
+  // Declarations by original buffer and offset
+  slang::flat_hash_map<uint64_t, decl_ref> known;
+};
+
+ReferenceIndex::ReferenceIndex(
+    slang::Compilation &compilation, const slang::SourceManager &sm,
+    SourcePositions &positions,
+    const std::map<FileId, std::shared_ptr<slang::SyntaxTree>> &trees,
+    const ReferenceIndex *previous, const std::function<bool()> &abandoned) {
+  positions.setSourceManager(&sm);
+  // The included files have no tree, their text tells if they changed
+  slang::flat_hash_map<FileId, size_t> headers;
+  for (auto buffer : sm.getAllBuffers()) {
+    if (!sm.getIncludedFrom(buffer).valid())
+      continue;
+    FileId file = positions.getBufferFile(buffer);
+    if (file == FileTable::invalid || trees.count(file) ||
+        headers.count(file))
+      continue;
+    headers.emplace(file,
+                    std::hash<std::string_view>{}(sm.getSourceText(buffer)));
+  }
+
+  // Files that are new, edited or gone since the previous index
+  slang::flat_hash_set<FileId> changed;
+  for (auto &[file, tree] : trees) {
+    auto old = previous != nullptr ? previous->getFile(file) : nullptr;
+    if (old == nullptr || old->tree.lock() != tree)
+      changed.insert(file);
+  }
+  for (auto &[file, hash] : headers) {
+    auto old = previous != nullptr ? previous->getFile(file) : nullptr;
+    if (old == nullptr || old->hash != hash)
+      changed.insert(file);
+  }
+  if (previous != nullptr) {
+    for (auto &[file, old] : previous->files)
+      if (!trees.count(file) && !headers.count(file))
+        changed.insert(file);
+  }
+
+  // The declarations of the changed files are numbered again, so the files
+  // using them are indexed again too
+  std::map<FileId, file_index> building;
+  auto reuse = [&](FileId file) {
+    if (changed.count(file))
+      return false;
+    for (auto used : previous->getFile(file)->uses)
+      if (changed.count(used))
+        return false;
+    files[file] = previous->files.at(file);
+    return true;
+  };
+  for (auto &[file, tree] : trees)
+    if (!reuse(file))
+      building[file].tree = tree;
+  for (auto &[file, hash] : headers)
+    if (!reuse(file))
+      building[file].hash = hash;
+
+  // Lists of users changed by this index, copied from the previous one
+  slang::flat_hash_map<uint64_t, std::vector<FileId>> edited;
+  auto edit = [&](uint64_t key) -> std::vector<FileId> & {
+    auto res = edited.find(key);
+    if (res != edited.end())
+      return res->second;
+    auto &list = edited[key];
+    auto old = users.find(key);
+    if (old != users.end())
+      list = *old->second;
+    return list;
+  };
+
+  // Drop the uses of the files indexed again
+  if (previous != nullptr) {
+    users = previous->users;
+    for (auto &[file, old] : previous->files) {
+      if (files.count(file))
+        continue;
+      for (auto &occ : old->occurrences) {
+        if (!users.count(occ.decl.key()))
+          continue;
+        auto &list = edit(occ.decl.key());
+        list.erase(std::remove(list.begin(), list.end(), file), list.end());
+      }
+    }
+  }
+
+  ReferenceVisitor visitor(*this, positions, sm, building, abandoned);
+  compilation.getRoot().visit(visitor);
+
+  for (auto &[file, index] : building) {
+    finishFile(index);
+    for (auto pos : index.by_decl) {
+      auto &list = edit(index.occurrences[pos].decl.key());
+      if (list.empty() || list.back() != file)
+        list.push_back(file);
+    }
+    files[file] = std::make_shared<const file_index>(std::move(index));
+  }
+  for (auto &[key, list] : edited) {
+    if (list.empty())
+      users.erase(key);
+    else
+      users[key] =
+          std::make_shared<const std::vector<FileId>>(std::move(list));
+  }
+  indexed_files = building.size();
+}
+
+void ReferenceIndex::finishFile(file_index &index) {
+  // Every instance of a module adds the same names again
+  auto &occurrences = index.occurrences;
+  std::sort(occurrences.begin(), occurrences.end(),
+            [](const occurrence &a, const occurrence &b) {
+              if (a.start != b.start)
+                return a.start < b.start;
+              return a.decl.key() < b.decl.key();
+            });
+  auto last = std::unique(occurrences.begin(), occurrences.end(),
+                          [](const occurrence &a, const occurrence &b) {
+                            return a.start == b.start &&
+                                   a.decl.key() == b.decl.key();
+                          });
+  occurrences.erase(last, occurrences.end());
+  occurrences.shrink_to_fit();
+
+  index.by_decl.resize(occurrences.size());
+  std::iota(index.by_decl.begin(), index.by_decl.end(), 0);
+  std::stable_sort(index.by_decl.begin(), index.by_decl.end(),
+                   [&](uint32_t a, uint32_t b) {
+                     return occurrences[a].decl.key() <
+                            occurrences[b].decl.key();
+                   });
+
+  auto &declarations = index.declarations;
+  declarations.shrink_to_fit();
+  index.decl_order.resize(declarations.size());
+  std::iota(index.decl_order.begin(), index.decl_order.end(), 0);
+  std::sort(index.decl_order.begin(), index.decl_order.end(),
+            [&](uint32_t a, uint32_t b) {
+              return makeKey(declarations[a].range.start) <
+                     makeKey(declarations[b].range.start);
+            });
+
+  for (auto &occ : occurrences)
+    index.uses.push_back(occ.decl.file);
+  for (auto &decl : declarations)
+    if (decl.type.valid())
+      index.uses.push_back(decl.type.file);
+  std::sort(index.uses.begin(), index.uses.end());
+  index.uses.erase(std::unique(index.uses.begin(), index.uses.end()),
+                   index.uses.end());
+}
+
+const ReferenceIndex::file_index *ReferenceIndex::getFile(FileId file) const {
+  auto res = files.find(file);
+  if (res == files.end())
+    return nullptr;
+  return res->second.get();
+}
+
+ReferenceIndex::decl_ref
+ReferenceIndex::findDeclaration(FileId file, const lsPosition &start) const {
+  auto index = getFile(file);
+  if (index == nullptr)
+    return {};
+  auto key = makeKey(start);
+  auto &declarations = index->declarations;
+  auto res = std::lower_bound(index->decl_order.begin(),
+                              index->decl_order.end(), key,
+                              [&](uint32_t decl, uint64_t value) {
+                                return makeKey(declarations[decl].range.start) <
+                                       value;
+                              });
+  if (res == index->decl_order.end() ||
+      makeKey(declarations[*res].range.start) != key)
+    return {};
+  return {file, *res};
+}
+
+const ReferenceIndex::occurrence *
+ReferenceIndex::findOccurrence(FileId file, const lsPosition &position) const {
+  auto index = getFile(file);
+  if (index == nullptr)
+    return nullptr;
+  auto &occurrences = index->occurrences;
+
+  // Last name starting before the position, it must also end after it
+  auto key = makeKey(position);
+  auto next = std::upper_bound(occurrences.begin(), occurrences.end(), key,
+                               [](uint64_t value, const occurrence &occ) {
+                                 return value < occ.start;
+                               });
+  if (next == occurrences.begin())
+    return nullptr;
+  auto &found = *(next - 1);
+  if (found.end < key)
+    return nullptr;
+  return &found;
+}
+
+std::optional<ReferenceIndex::location>
+ReferenceIndex::getLocation(decl_ref decl) const {
+  auto index = decl.valid() ? getFile(decl.file) : nullptr;
+  if (index == nullptr || decl.index >= index->declarations.size())
+    return std::nullopt;
+  return location{decl.file, index->declarations[decl.index].range};
+}
+
+std::optional<ReferenceIndex::location>
+ReferenceIndex::findDefinition(FileId file, const lsPosition &position) const {
+  auto occ = findOccurrence(file, position);
+  if (occ == nullptr)
+    return std::nullopt;
+  return getLocation(occ->decl);
+}
+
+std::optional<ReferenceIndex::location>
+ReferenceIndex::findTypeDefinition(FileId file,
+                                   const lsPosition &position) const {
+  auto occ = findOccurrence(file, position);
+  if (occ == nullptr)
+    return std::nullopt;
+  auto index = getFile(occ->decl.file);
+  if (index == nullptr || occ->decl.index >= index->declarations.size())
+    return std::nullopt;
+  // Names of types have no type of their own
+  return getLocation(index->declarations[occ->decl.index].type);
+}
+
+std::vector<ReferenceIndex::location>
+ReferenceIndex::findReferences(FileId file, const lsPosition &position,
+                               bool include_declaration,
+                               const std::function<bool()> &abandoned) const {
+  std::vector<location> result;
+  auto occ = findOccurrence(file, position);
+  if (occ == nullptr)
+    return result;
+  auto decl = occ->decl;
+  auto declared = getLocation(decl);
+  auto res = users.find(decl.key());
+  if (res == users.end())
+    return result;
+
+  auto to_position = [](uint64_t key) {
+    lsPosition pos;
+    pos.line = static_cast<int>(key >> 32);
+    pos.character = static_cast<int>(key & 0xffffffff);
+    return pos;
+  };
+  for (auto user : *res->second) {
+    if (abandoned && abandoned())
+      break;
+    auto index = getFile(user);
+    if (index == nullptr)
+      continue;
+    auto &occurrences = index->occurrences;
+    auto first = std::lower_bound(index->by_decl.begin(), index->by_decl.end(),
+                                  decl.key(), [&](uint32_t pos, uint64_t key) {
+                                    return occurrences[pos].decl.key() < key;
+                                  });
+    for (auto it = first; it != index->by_decl.end() &&
+                          occurrences[*it].decl.key() == decl.key();
+         ++it) {
+      auto &found = occurrences[*it];
+      location loc{user, {to_position(found.start), to_position(found.end)}};
+      if (!include_declaration && declared && user == declared->file &&
+          found.start == makeKey(declared->range.start))
+        continue;
+      result.push_back(loc);
+    }
+  }
+
+  std::sort(result.begin(), result.end(),
+            [](const location &a, const location &b) {
+              if (a.file != b.file)
+                return a.file < b.file;
+              return makeKey(a.range.start) < makeKey(b.range.start);
+            });
+  return result;
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include "FileTable.h"
+#include "LibLsp/lsp/lsRange.h"
+#include "SourcePositions.h"
+#include <cstdint>
+#include <flat_hash_map.hpp>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <slang/compilation/Compilation.h>
+#include <slang/syntax/SyntaxTree.h>
+#include <slang/text/SourceManager.h>
+#include <vector>
+
+class ReferenceVisitor;
+
+// Names used in the design and the declaration each one resolves to.
+// The names of a file are sorted by position, so finding the declaration
+// under the cursor is a binary search, without elaborating again. The files
+// using each declaration are also kept, to find all its references.
+//
+// A new index reuses the files of the previous one whose syntax tree, or
+// text for the included ones, did not change and that do not use
+// declarations of the changed files.
+class ReferenceIndex {
+public:
+  struct location {
+    FileId file;
+    lsRange range;
+  };
+
+  // Index the names of an elaborated compilation, made of the given trees.
+  // Once abandoned() is true the visit stops at the next instance, and the
+  // index is incomplete.
+  ReferenceIndex(
+      slang::Compilation &compilation, const slang::SourceManager &sm,
+      SourcePositions &positions,
+      const std::map<FileId, std::shared_ptr<slang::SyntaxTree>> &trees,
+      const ReferenceIndex *previous = nullptr,
+      const std::function<bool()> &abandoned = nullptr);
+
+  // Declaration of the name at a position
+  std::optional<location> findDefinition(FileId file,
+                                         const lsPosition &position) const;
+  // Declaration of the type of the name at a position
+  std::optional<location> findTypeDefinition(FileId file,
+                                             const lsPosition &position) const;
+  // Every use of the declaration of the name at a position. Stops between
+  // files once abandoned() is true.
+  std::vector<location>
+  findReferences(FileId file, const lsPosition &position,
+                 bool include_declaration,
+                 const std::function<bool()> &abandoned = nullptr) const;
+
+  // Files indexed again when building this index
+  size_t getIndexedFiles() const { return indexed_files; }
+
+private:
+  friend class ReferenceVisitor;
+
+  // Positions packed to be compared as a single number
+  static uint64_t makeKey(const lsPosition &position) {
+    return static_cast<uint64_t>(position.line) << 32 |
+           static_cast<uint32_t>(position.character);
+  }
+
+  // Declaration number in the file declaring it
+  struct decl_ref {
+    FileId file;
+    uint32_t index;
+
+    bool valid() const { return file != FileTable::invalid; }
+    uint64_t key() const { return static_cast<uint64_t>(file) << 32 | index; }
+  };
+
+  struct occurrence {
+    uint64_t start, end;
+    decl_ref decl;
+  };
+
+  struct declaration {
+    lsRange range;
+    // Declaration of its type, invalid for the built-in ones
+    decl_ref type;
+  };
+
+  // Never modified once built, the next indexes share it while it is valid
+  struct file_index {
+    std::weak_ptr<slang::SyntaxTree> tree;
+    // Hash of the text of the included files, which have no tree
+    size_t hash = 0;
+    // Sorted by start
+    std::vector<occurrence> occurrences;
+    // Positions in occurrences, sorted by declaration
+    std::vector<uint32_t> by_decl;
+    std::vector<declaration> declarations;
+    // Positions in declarations, sorted by start
+    std::vector<uint32_t> decl_order;
+    // Files declaring the names used here, sorted
+    std::vector<FileId> uses;
+  };
+
+  const file_index *getFile(FileId file) const;
+  const occurrence *findOccurrence(FileId file,
+                                   const lsPosition &position) const;
+  std::optional<location> getLocation(decl_ref decl) const;
+  // Declaration starting at a position, invalid if there is none
+  decl_ref findDeclaration(FileId file, const lsPosition &start) const;
+  // Sort the names of a new file and list what it uses
+  static void finishFile(file_index &index);
+
+  slang::flat_hash_map<FileId, std::shared_ptr<const file_index>> files;
+  // Files using each declaration, by decl_ref::key. The lists are shared
+  // with the next indexes, which copy the ones they change.
+  slang::flat_hash_map<uint64_t, std::shared_ptr<const std::vector<FileId>>>
+      users;
+  size_t indexed_files = 0;
+};
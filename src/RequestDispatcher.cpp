@@ -0,0 +1,100 @@
+#include "RequestDispatcher.h"
+#include "TraceWriter.h"
+#include <algorithm>
+#include <exception>
+#include <iostream>
+
+RequestDispatcher::RequestDispatcher(size_t interactive_workers,
+                                     size_t background_workers)
+    : stopping(false) {
+  lanes[interactive].name = "interactive";
+  lanes[background].name = "background";
+  std::array<size_t, lane_count> workers = {interactive_workers,
+                                            background_workers};
+  for (size_t i = 0; i < lane_count; i++) {
+    auto &l = lanes[i];
+    for (size_t j = 0; j < std::max<size_t>(workers[i], 1); j++)
+      l.workers.emplace_back([this, &l]() { run(l); });
+  }
+}
+
+RequestDispatcher::~RequestDispatcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  for (auto &l : lanes) {
+    l.cv.notify_all();
+    for (auto &worker : l.workers)
+      worker.join();
+  }
+}
+
+std::string RequestDispatcher::getKey(const lsRequestId &id) {
+  if (id.type == lsRequestId::kInt)
+    return std::to_string(id.value);
+  return id.k_string;
+}
+
+void RequestDispatcher::post(lane_id lane, const lsRequestId &id,
+                             task_fn fn) {
+  auto &l = lanes[lane];
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    task t{getKey(id), std::move(fn), std::make_shared<std::atomic<bool>>(),
+           std::chrono::steady_clock::now()};
+    pending[t.key] = t.cancelled;
+    l.queue.push_back(std::move(t));
+  }
+  l.cv.notify_one();
+}
+
+void RequestDispatcher::cancel(const lsRequestId &id) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto res = pending.find(getKey(id));
+  if (res != pending.end())
+    *res->second = true;
+}
+
+std::vector<RequestDispatcher::lane_stats> RequestDispatcher::getStats() const {
+  std::vector<lane_stats> stats;
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto &l : lanes)
+    stats.push_back({l.name, l.workers.size(), l.queue.size(), l.running,
+                     l.completed, l.total_wait, l.max_wait});
+  return stats;
+}
+
+void RequestDispatcher::run(lane &l) {
+  TraceWriter::setThreadName(l.name);
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    l.cv.wait(lock, [&]() { return stopping || !l.queue.empty(); });
+    if (stopping)
+      return;
+
+    auto t = std::move(l.queue.front());
+    l.queue.pop_front();
+    auto wait = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - t.arrival);
+    l.total_wait += wait;
+    l.max_wait = std::max(l.max_wait, wait);
+    l.running++;
+    lock.unlock();
+
+    auto cancelled = t.cancelled;
+    try {
+      t.fn([cancelled]() { return cancelled->load() ? 1 : 0; });
+    } catch (const std::exception &e) {
+      std::cerr << "Request failed: " << e.what() << std::endl;
+    }
+
+    lock.lock();
+    l.running--;
+    l.completed++;
+    // A newer request may reuse the id
+    auto res = pending.find(t.key);
+    if (res != pending.end() && res->second == t.cancelled)
+      pending.erase(res);
+  }
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "LibLsp/JsonRpc/RemoteEndPoint.h"
+#include "LibLsp/JsonRpc/RequestInMessage.h"
+#include "LibLsp/JsonRpc/lsResponseMessage.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Thrown by the handlers run on a lane, to answer with this error
+class RequestError : public std::runtime_error {
+public:
+  RequestError(lsErrorCodes code, const std::string &message)
+      : std::runtime_error(message), code(code) {}
+
+  const lsErrorCodes code;
+};
+
+// Runs the requests on worker lanes, so a slow request does not delay the
+// quick ones behind it. The endpoint thread still reads the messages in
+// order and handles the notifications itself, so a request always sees the
+// edits sent before it.
+class RequestDispatcher {
+public:
+  enum lane_id { interactive, background, lane_count };
+
+  typedef std::function<void(const CancelMonitor &monitor)> task_fn;
+
+  struct lane_stats {
+    const char *name;
+    size_t workers;
+    // Requests waiting and running right now
+    size_t queued, running;
+    uint64_t completed;
+    // Time between the arrival of the requests and their start
+    std::chrono::microseconds total_wait, max_wait;
+  };
+
+  RequestDispatcher(size_t interactive_workers = default_interactive_workers,
+                    size_t background_workers = default_background_workers);
+  ~RequestDispatcher();
+
+  // Run a request on a lane. The monitor of the task is set when the client
+  // cancels the request, a cancelled task still has to answer.
+  void post(lane_id lane, const lsRequestId &id, task_fn task);
+  // Handle a $/cancelRequest
+  void cancel(const lsRequestId &id);
+
+  std::vector<lane_stats> getStats() const;
+
+  static constexpr size_t default_interactive_workers = 2;
+  static constexpr size_t default_background_workers = 1;
+
+private:
+  struct task {
+    std::string key;
+    task_fn fn;
+    std::shared_ptr<std::atomic<bool>> cancelled;
+    std::chrono::steady_clock::time_point arrival;
+  };
+
+  struct lane {
+    const char *name;
+    std::deque<task> queue;
+    std::condition_variable cv;
+    std::vector<std::thread> workers;
+    size_t running = 0;
+    uint64_t completed = 0;
+    std::chrono::microseconds total_wait{0}, max_wait{0};
+  };
+
+  void run(lane &l);
+  static std::string getKey(const lsRequestId &id);
+
+  mutable std::mutex mutex;
+  bool stopping;
+  std::array<lane, lane_count> lanes;
+  // Flags of the requests not finished yet, by id
+  std::map<std::string, std::shared_ptr<std::atomic<bool>>> pending;
+};
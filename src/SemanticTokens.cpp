@@ -0,0 +1,340 @@
+#include "SemanticTokens.h"
+#include <algorithm>
+#include <flat_hash_map.hpp>
+#include <slang/parsing/LexerFacts.h>
+#include <slang/syntax/AllSyntax.h>
+#include <slang/syntax/SyntaxVisitor.h>
+
+// Walks the tokens of a tree, with their trivia. The declarations are
+// visited before their tokens, so they classify the names first.
+class SemanticTokenCollector
+    : public slang::SyntaxVisitor<SemanticTokenCollector> {
+public:
+  SemanticTokenCollector(
+      SemanticTokens &result, const slang::SyntaxTree &tree,
+      const NodeVisitor *nv, FileId file,
+      const std::optional<std::pair<size_t, size_t>> &visible)
+      : result(result), nv(nv), file(file), visible(visible),
+        // The end of file is never included from elsewhere
+        buffer(tree.root().getLastToken().location().buffer()) {}
+
+  // Nodes out of the requested range are skipped
+  template <typename T> void handle(const T &syntax) {
+    if (visible) {
+      auto start = getOffset(syntax.getFirstToken());
+      auto end = getOffset(syntax.getLastToken());
+      if ((end && *end < visible->first) ||
+          (start && *start > visible->second))
+        return;
+    }
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::ModuleDeclarationSyntax &syntax) {
+    auto type = SemanticTokens::type_class;
+    if (syntax.kind == slang::SyntaxKind::PackageDeclaration)
+      type = SemanticTokens::type_namespace;
+    else if (syntax.kind == slang::SyntaxKind::InterfaceDeclaration)
+      type = SemanticTokens::type_interface;
+    classify(syntax.header->name, type, SemanticTokens::modifier_declaration);
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::ClassDeclarationSyntax &syntax) {
+    classify(syntax.name, SemanticTokens::type_class,
+             SemanticTokens::modifier_declaration);
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::FunctionPrototypeSyntax &syntax) {
+    classify(syntax.name->getLastToken(), SemanticTokens::type_function,
+             SemanticTokens::modifier_declaration);
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::TypedefDeclarationSyntax &syntax) {
+    classify(syntax.name, SemanticTokens::type_type,
+             SemanticTokens::modifier_declaration);
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::NamedTypeSyntax &syntax) {
+    classify(syntax.name->getLastToken(), SemanticTokens::type_type);
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::ParameterDeclarationSyntax &syntax) {
+    for (auto decl : syntax.declarators)
+      classify(decl->name, SemanticTokens::type_variable,
+               SemanticTokens::modifier_declaration |
+                   SemanticTokens::modifier_readonly);
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::EnumTypeSyntax &syntax) {
+    for (auto member : syntax.members)
+      classify(member->name, SemanticTokens::type_enum_member,
+               SemanticTokens::modifier_declaration |
+                   SemanticTokens::modifier_readonly);
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::StructUnionMemberSyntax &syntax) {
+    for (auto decl : syntax.declarators)
+      classify(decl->name, SemanticTokens::type_property,
+               SemanticTokens::modifier_declaration);
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::DeclaratorSyntax &syntax) {
+    classify(syntax.name, SemanticTokens::type_variable,
+             SemanticTokens::modifier_declaration);
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::HierarchyInstantiationSyntax &syntax) {
+    classify(syntax.type, SemanticTokens::type_class);
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::InstanceNameSyntax &syntax) {
+    classify(syntax.name, SemanticTokens::type_variable,
+             SemanticTokens::modifier_declaration);
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::NamedPortConnectionSyntax &syntax) {
+    classify(syntax.name, SemanticTokens::type_property);
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::NamedParamAssignmentSyntax &syntax) {
+    classify(syntax.name, SemanticTokens::type_property);
+    visitDefault(syntax);
+  }
+
+  void handle(const slang::InvocationExpressionSyntax &syntax) {
+    classify(syntax.left->getLastToken(), SemanticTokens::type_function);
+    visitDefault(syntax);
+  }
+
+  void visitToken(slang::Token token) {
+    auto offset = getOffset(token);
+    visitTrivia(token, offset);
+    if (!offset)
+      return;
+
+    auto kind = token.kind;
+    switch (kind) {
+    case slang::TokenKind::Identifier:
+      classifyName(token, *offset);
+      return;
+    case slang::TokenKind::SystemIdentifier:
+      add(*offset, token, SemanticTokens::type_function,
+          SemanticTokens::modifier_default_library);
+      return;
+    case slang::TokenKind::StringLiteral:
+    case slang::TokenKind::IncludeFileName:
+      add(*offset, token, SemanticTokens::type_string);
+      return;
+    case slang::TokenKind::IntegerLiteral:
+    case slang::TokenKind::IntegerBase:
+    case slang::TokenKind::UnbasedUnsizedLiteral:
+    case slang::TokenKind::RealLiteral:
+    case slang::TokenKind::TimeLiteral:
+      add(*offset, token, SemanticTokens::type_number);
+      return;
+    case slang::TokenKind::Directive:
+    case slang::TokenKind::MacroUsage:
+      add(*offset, token, SemanticTokens::type_macro);
+      return;
+    default:
+      if (slang::LexerFacts::isKeyword(kind))
+        add(*offset, token, SemanticTokens::type_keyword);
+    }
+  }
+
+private:
+  typedef std::pair<uint32_t, uint32_t> classification;
+
+  std::optional<size_t> getOffset(slang::Token token) const {
+    if (!token.valid())
+      return std::nullopt;
+    auto location = token.location();
+    if (location.buffer() != buffer)
+      return std::nullopt;
+    return location.offset();
+  }
+
+  // The first declaration seen for a name wins over the inner ones
+  void classify(slang::Token name, uint32_t type, uint32_t modifiers = 0) {
+    auto offset = getOffset(name);
+    if (offset)
+      names.emplace(*offset, classification(type, modifiers));
+  }
+
+  void classifyName(slang::Token token, size_t offset) {
+    auto res = names.find(offset);
+    if (res != names.end()) {
+      add(offset, token, res->second.first, res->second.second);
+      return;
+    }
+    if (nv == nullptr)
+      return;
+
+    auto name = token.valueText();
+    if (nv->findPackage(name) != nullptr) {
+      add(offset, token, SemanticTokens::type_namespace);
+      return;
+    }
+    auto &lines = result.lines;
+    size_t line = lines.lineOf(offset);
+    auto chain = nv->getScopeChain(
+        file, NodeVisitor::makePosition(line, offset - lines.lineStart(line)));
+    if (nv->findSymbol(file, name, chain) != nullptr)
+      add(offset, token, SemanticTokens::type_variable);
+  }
+
+  // The trivia is just before the token, so it is walked backwards from
+  // there. Directives have their own locations.
+  void visitTrivia(slang::Token token, std::optional<size_t> offset) {
+    auto trivia = token.trivia();
+    for (auto it = trivia.rbegin(); it != trivia.rend(); it++) {
+      if (auto syntax = it->syntax()) {
+        visit(*syntax);
+        offset = getOffset(syntax->getFirstToken());
+        continue;
+      }
+      auto text = it->getRawText();
+      if (!offset || *offset < text.size()) {
+        offset.reset();
+        continue;
+      }
+      *offset -= text.size();
+      if (it->kind == slang::TriviaKind::LineComment ||
+          it->kind == slang::TriviaKind::BlockComment)
+        add(*offset, text.size(), SemanticTokens::type_comment, 0);
+    }
+  }
+
+  void add(size_t offset, slang::Token token, uint32_t type,
+           uint32_t modifiers = 0) {
+    add(offset, token.rawText().size(), type, modifiers);
+  }
+
+  // Split in lines, the clients may not support tokens spanning several
+  void add(size_t offset, size_t length, uint32_t type, uint32_t modifiers) {
+    auto &lines = result.lines;
+    size_t end = offset + length;
+    if (visible && (end < visible->first || offset > visible->second))
+      return;
+    for (size_t line = lines.lineOf(offset); offset < end; line++) {
+      size_t line_end = lines.lineStart(line) + lines.getLine(line).size();
+      size_t part_end = std::min(end, line_end);
+      if (part_end > offset)
+        result.tokens.push_back({offset, part_end - offset, type, modifiers});
+      if (line + 1 >= lines.lineCount())
+        break;
+      offset = lines.lineStart(line + 1);
+    }
+  }
+
+  SemanticTokens &result;
+  const NodeVisitor *nv;
+  FileId file;
+  // Offsets of the requested range
+  std::optional<std::pair<size_t, size_t>> visible;
+  slang::BufferID buffer;
+  // Names classified by their declaration or use, by offset
+  slang::flat_hash_map<size_t, classification> names;
+};
+
+SemanticTokens::SemanticTokens(const slang::SyntaxTree &tree,
+                               const LineIndex &lines, const NodeVisitor *nv,
+                               FileId file, const std::optional<lsRange> &range)
+    : lines(lines) {
+  std::optional<std::pair<size_t, size_t>> visible;
+  if (range)
+    visible.emplace(lines.lineStart(range->start.line),
+                    lines.lineStart(range->end.line + 1));
+  SemanticTokenCollector collector(*this, tree, nv, file, visible);
+  collector.visit(tree.root());
+  // The trivia is walked backwards, and directives can come from anywhere
+  std::stable_sort(
+      tokens.begin(), tokens.end(),
+      [](const token &a, const token &b) { return a.offset < b.offset; });
+}
+
+std::vector<uint32_t> SemanticTokens::encode() const {
+  std::vector<uint32_t> data;
+  data.reserve(tokens.size() * 5);
+  size_t prev_line = 0, prev_character = 0, prev_end = 0;
+  auto text = lines.getText();
+  for (auto &tok : tokens) {
+    // Overlapping tokens are not allowed
+    if (tok.offset < prev_end)
+      continue;
+    auto pos = lines.positionAt(tok.offset);
+    data.push_back(pos.line - prev_line);
+    data.push_back(pos.line == prev_line ? pos.character - prev_character
+                                         : pos.character);
+    data.push_back(LineIndex::utf16Length(text.substr(tok.offset, tok.length)));
+    data.push_back(tok.type);
+    data.push_back(tok.modifiers);
+    prev_line = pos.line;
+    prev_character = pos.character;
+    prev_end = tok.offset + tok.length;
+  }
+  return data;
+}
+
+SemanticTokenLegend SemanticTokens::getLegend() {
+  SemanticTokenLegend legend;
+  legend.tokenTypes = {"namespace", "type",     "class",    "interface",
+                       "enumMember", "variable", "property", "function",
+                       "macro",      "keyword",  "comment",  "string",
+                       "number"};
+  legend.tokenModifiers = {"declaration", "readonly", "defaultLibrary"};
+  return legend;
+}
+
+std::string SemanticTokenStore::update(FileId file,
+                                       const std::vector<uint32_t> &data) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &res = files[file];
+  res.result_id = std::to_string(++last_result_id);
+  res.data = data;
+  return res.result_id;
+}
+
+std::optional<std::vector<SemanticTokenEdit>>
+SemanticTokenStore::diff(FileId file, const std::string &previous_id,
+                         const std::vector<uint32_t> &data) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto res = files.find(file);
+  if (res == files.end() || res->second.result_id != previous_id)
+    return std::nullopt;
+
+  // An edit replaces what lies between the common start and end. Typing
+  // changes a few tokens around the cursor, the rest stays the same.
+  auto &old = res->second.data;
+  size_t prefix = 0;
+  size_t common = std::min(old.size(), data.size());
+  while (prefix < common && old[prefix] == data[prefix])
+    prefix++;
+  size_t suffix = 0;
+  while (suffix < common - prefix &&
+         old[old.size() - suffix - 1] == data[data.size() - suffix - 1])
+    suffix++;
+
+  std::vector<SemanticTokenEdit> edits;
+  if (prefix == old.size() && prefix == data.size())
+    return edits;
+  SemanticTokenEdit edit;
+  edit.start = prefix;
+  edit.deleteCount = old.size() - prefix - suffix;
+  edit.data = std::vector<uint32_t>(data.begin() + prefix,
+                                    data.end() - suffix);
+  edits.push_back(std::move(edit));
+  return edits;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "FileTable.h"
+#include "LibLsp/lsp/lsRange.h"
+#include "LineIndex.h"
+#include "LspExtensions.h"
+#include "NodeVisitor.h"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <slang/syntax/SyntaxTree.h>
+#include <string>
+#include <vector>
+
+class SemanticTokenCollector;
+
+// Semantic highlighting of a file. The tokens are read from its syntax tree,
+// so they follow the text being edited: comments, literals, keywords and
+// directives by their lexical kind, names by the syntax declaring them, or
+// else by the symbols of the last compilation. The result is encoded with
+// positions relative to the previous token, as the protocol requires.
+class SemanticTokens {
+public:
+  // Positions in the legend
+  enum token_type : uint32_t {
+    type_namespace,
+    type_type,
+    type_class,
+    type_interface,
+    type_enum_member,
+    type_variable,
+    type_property,
+    type_function,
+    type_macro,
+    type_keyword,
+    type_comment,
+    type_string,
+    type_number,
+  };
+  enum token_modifier : uint32_t {
+    modifier_declaration = 1,
+    modifier_readonly = 2,
+    modifier_default_library = 4,
+  };
+
+  // Tokens of the whole file, or only of the lines of a range. nv can be
+  // nullptr, then the names are only known from the syntax.
+  SemanticTokens(const slang::SyntaxTree &tree, const LineIndex &lines,
+                 const NodeVisitor *nv, FileId file,
+                 const std::optional<lsRange> &range = {});
+
+  std::vector<uint32_t> encode() const;
+
+  static SemanticTokenLegend getLegend();
+
+private:
+  friend class SemanticTokenCollector;
+
+  struct token {
+    size_t offset, length;
+    uint32_t type, modifiers;
+  };
+
+  // Tokens of the file sorted by offset, none spans several lines
+  std::vector<token> tokens;
+  const LineIndex &lines;
+};
+
+// Last tokens sent for each file, the base of the next delta
+class SemanticTokenStore {
+public:
+  // Store the tokens sent for a file, returns their result id
+  std::string update(FileId file, const std::vector<uint32_t> &data);
+  // Edits from a previous result to the new tokens. nullopt if that result is
+  // not the last one of the file, then all the data has to be sent.
+  std::optional<std::vector<SemanticTokenEdit>>
+  diff(FileId file, const std::string &previous_id,
+       const std::vector<uint32_t> &data) const;
+
+private:
+  struct entry {
+    std::string result_id;
+    std::vector<uint32_t> data;
+  };
+
+  mutable std::mutex mutex;
+  std::map<FileId, entry> files;
+  uint64_t last_result_id = 0;
+};
@@ -1,6 +1,7 @@
 #pragma once
 #include "LibLsp/JsonRpc/serializer.h"
 #include "LibLsp/lsp/lsAny.h"
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -9,12 +10,22 @@ struct ServerConfig {
   std::vector<std::string> libraryPaths;
   std::vector<std::string> filelists;
   std::vector<std::string> compileFiles;
+  // Milliseconds without changes before checking the syntax of edited files
+  std::optional<int> syntaxDelay;
+  // Milliseconds without changes before starting a full compilation
+  std::optional<int> compileDelay;
+  // Run the full compilation only when a file is saved
+  std::optional<bool> compileOnSave;
+  // Maximum number of completion items sent
+  std::optional<int> completionLimit;
 };
 
 MAKE_REFLECT_STRUCT(ServerConfig, includePaths, libraryPaths, filelists,
-                    compileFiles);
+                    compileFiles, syntaxDelay, compileDelay, compileOnSave,
+                    completionLimit);
 REFLECT_MAP_TO_STRUCT(ServerConfig, includePaths, libraryPaths, filelists,
-                      compileFiles);
+                      compileFiles, syntaxDelay, compileDelay, compileOnSave,
+                      completionLimit);
 struct ServerConfigTop {
   ServerConfig verilog;
 };
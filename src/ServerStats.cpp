@@ -0,0 +1,162 @@
+#include "ServerStats.h"
+#include <algorithm>
+#include <fmt/core.h>
+#include <fstream>
+#include <iostream>
+#include <sys/resource.h>
+#include <unistd.h>
+
+static double toMs(std::chrono::microseconds duration) {
+  return duration.count() / 1000.0;
+}
+
+void ServerStats::histogram::add(std::chrono::microseconds duration) {
+  // Bucket i holds the durations below 2^i microseconds
+  size_t bucket = 0;
+  for (auto us = duration.count(); us > 0; us >>= 1)
+    bucket++;
+  buckets[std::min(bucket, bucket_count - 1)]++;
+  count++;
+  total += duration;
+  max = std::max(max, duration);
+}
+
+std::chrono::microseconds
+ServerStats::histogram::percentile(double fraction) const {
+  uint64_t seen = 0;
+  for (size_t i = 0; i < bucket_count; i++) {
+    seen += buckets[i];
+    if (seen > 0 && seen >= fraction * count)
+      return std::min(max, std::chrono::microseconds(uint64_t(1) << i));
+  }
+  return max;
+}
+
+LatencyStats ServerStats::histogram::report(const std::string &name) const {
+  LatencyStats res;
+  res.name = name;
+  res.count = count;
+  res.totalMs = toMs(total);
+  res.meanMs = count ? res.totalMs / count : 0;
+  res.p50Ms = toMs(percentile(0.5));
+  res.p90Ms = toMs(percentile(0.9));
+  res.p99Ms = toMs(percentile(0.99));
+  res.maxMs = toMs(max);
+  return res;
+}
+
+ServerStats::ServerStats(const std::string &trace_path) {
+  if (trace_path.empty())
+    return;
+  trace = std::make_unique<TraceWriter>(trace_path);
+  if (!trace->isOpen()) {
+    std::cerr << "Cannot write the trace to " << trace_path << std::endl;
+    trace.reset();
+  }
+}
+
+void ServerStats::addRequest(const char *method, clock::time_point arrival,
+                             clock::time_point start) {
+  auto end = clock::now();
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(end -
+                                                                  arrival);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    requests[method].add(us);
+  }
+  if (trace) {
+    auto wait =
+        std::chrono::duration_cast<std::chrono::microseconds>(start - arrival);
+    trace->addEvent(method, "request", start, end,
+                    {{"wait_ms", fmt::format("{:.3f}", toMs(wait))}});
+  }
+}
+
+void ServerStats::addPhase(phase_id phase, clock::time_point start,
+                           std::string_view detail) {
+  auto end = clock::now();
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    phases[phase].add(us);
+  }
+  if (!trace)
+    return;
+  TraceWriter::event_args args;
+  if (!detail.empty())
+    args.emplace_back("detail", std::string(detail));
+  trace->addEvent(getPhaseName(phase), "compile", start, end, args);
+}
+
+ServerStatsReport ServerStats::getReport() const {
+  ServerStatsReport res;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &[method, hist] : requests)
+      res.requests.push_back(hist.report(method));
+    for (size_t i = 0; i < phase_count; i++)
+      res.phases.push_back(
+          phases[i].report(getPhaseName(static_cast<phase_id>(i))));
+  }
+  res.memory = getMemoryUsage();
+  return res;
+}
+
+MemoryStats ServerStats::getMemoryUsage() {
+  MemoryStats res;
+  res.currentBytes = 0;
+  res.peakBytes = 0;
+#ifdef __linux__
+  // The second field is the number of resident pages
+  std::ifstream statm("/proc/self/statm");
+  uint64_t size, resident;
+  if (statm >> size >> resident)
+    res.currentBytes = resident * sysconf(_SC_PAGESIZE);
+#endif
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+    res.peakBytes = usage.ru_maxrss;
+#else
+    // In kilobytes everywhere else
+    res.peakBytes = uint64_t(usage.ru_maxrss) * 1024;
+#endif
+  }
+  return res;
+}
+
+const char *ServerStats::getPhaseName(phase_id phase) {
+  static const std::array<const char *, phase_count> names = {
+      "compile",   "syntax check", "load",        "parse",
+      "libraries", "elaboration",  "diagnostics", "format",
+      "publish",   "indexing",     "references"};
+  return names[phase];
+}
+
+void ServerStats::print(const ServerStatsReport &report, std::ostream &os) {
+  auto printLatencies = [&](const char *title,
+                            const std::vector<LatencyStats> &stats) {
+    os << fmt::format("{:<40} {:>8} {:>10} {:>9} {:>9} {:>9} {:>9}\n", title,
+                      "count", "total ms", "mean", "p50", "p99", "max");
+    for (auto &s : stats) {
+      if (s.count == 0)
+        continue;
+      os << fmt::format(
+          "{:<40} {:>8} {:>10.1f} {:>9.2f} {:>9.2f} {:>9.2f} {:>9.2f}\n",
+          s.name, s.count, s.totalMs, s.meanMs, s.p50Ms, s.p99Ms, s.maxMs);
+    }
+  };
+  printLatencies("Request", report.requests);
+  printLatencies("Phase", report.phases);
+
+  os << fmt::format("{:<40} {:>8} {:>10} {:>9} {:>9}\n", "Lane", "workers",
+                    "completed", "mean wait", "max wait");
+  for (auto &l : report.lanes)
+    os << fmt::format("{:<40} {:>8} {:>10} {:>9.2f} {:>9.2f}\n", l.name,
+                      l.workers, l.completed, l.meanWaitMs, l.maxWaitMs);
+
+  os << fmt::format("Memory: {} MiB resident, {} MiB at peak\n",
+                    report.memory.currentBytes >> 20,
+                    report.memory.peakBytes >> 20);
+  os.flush();
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "LspExtensions.h"
+#include "TraceWriter.h"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// Where the time goes: latency of the requests by method, and of the steps
+// of the compilations. Shared by all the threads of the server. Each of them
+// can also go to a trace, to see them in time.
+class ServerStats {
+public:
+  typedef TraceWriter::clock clock;
+
+  // Steps of a compilation. The compilations include all the other steps,
+  // and the library resolution includes the loading and parsing of the
+  // library files, which are counted in their phases too.
+  enum phase_id {
+    phase_compile,
+    phase_syntax_check,
+    phase_load,
+    phase_parse,
+    phase_libraries,
+    phase_elaboration,
+    phase_diagnostics,
+    phase_format,
+    phase_publish,
+    phase_indexing,
+    phase_references,
+    phase_count
+  };
+
+  // Distribution of durations, in power of two buckets of microseconds
+  class histogram {
+  public:
+    void add(std::chrono::microseconds duration);
+    // Upper bound of the bucket holding the given fraction of the samples
+    std::chrono::microseconds percentile(double fraction) const;
+    LatencyStats report(const std::string &name) const;
+
+    uint64_t count = 0;
+    std::chrono::microseconds total{0}, max{0};
+
+  private:
+    static constexpr size_t bucket_count = 40;
+    std::array<uint64_t, bucket_count> buckets{};
+  };
+
+  // Measures a phase until it goes out of scope. The detail, such as the
+  // file parsed, only goes to the trace.
+  class scoped_phase {
+  public:
+    scoped_phase(ServerStats &stats, phase_id phase, std::string detail = {})
+        : stats(stats), phase(phase), detail(std::move(detail)),
+          start(clock::now()) {}
+    ~scoped_phase() { stats.addPhase(phase, start, detail); }
+
+  private:
+    ServerStats &stats;
+    phase_id phase;
+    std::string detail;
+    clock::time_point start;
+  };
+
+  // Without a path, nothing is traced
+  explicit ServerStats(const std::string &trace_path = {});
+
+  // A request answered now, that started running after waiting in a queue
+  void addRequest(const char *method, clock::time_point arrival,
+                  clock::time_point start);
+  // A phase ending now
+  void addPhase(phase_id phase, clock::time_point start,
+                std::string_view detail = {});
+
+  // Requests and phases seen so far, with the memory usage. The lanes are
+  // filled by the dispatcher.
+  ServerStatsReport getReport() const;
+  // Resident memory of the process, now and at its peak
+  static MemoryStats getMemoryUsage();
+  static const char *getPhaseName(phase_id phase);
+  // Tables of a report, for the log
+  static void print(const ServerStatsReport &report, std::ostream &os);
+
+private:
+  mutable std::mutex mutex;
+  std::map<std::string, histogram> requests;
+  std::array<histogram, phase_count> phases;
+  std::unique_ptr<TraceWriter> trace;
+};
@@ -0,0 +1,63 @@
+#include "SourcePositions.h"
+#include "ProjectSources.h"
+#include <slang/text/SourceManager.h>
+
+SourcePositions::SourcePositions(ProjectSources &project_sources)
+    : sources(project_sources), sm(nullptr) {}
+
+void SourcePositions::setSourceManager(
+    const slang::SourceManager *source_manager) {
+  if (sm == source_manager)
+    return;
+  sm = source_manager;
+  buffers.clear();
+}
+
+const SourcePositions::buffer_info *
+SourcePositions::getBufferInfo(slang::BufferID buffer) {
+  if (!buffer || sm == nullptr)
+    return nullptr;
+  auto res = buffers.find(buffer.getId());
+  if (res != buffers.end())
+    return &res->second;
+
+  auto text = sm->getSourceText(buffer);
+  buffer_info info;
+  info.file = sources.getFiles().getId(
+      ProjectSources::getBufferPath(sm->getRawFileName(buffer)));
+  info.lines = sources.getLineIndex(info.file, text);
+  // Buffers that are not project files, like the included ones
+  if (info.lines == nullptr)
+    info.lines = std::make_shared<const LineIndex>(text);
+  return &(buffers[buffer.getId()] = info);
+}
+
+FileId SourcePositions::getFile(slang::SourceLocation location) {
+  if (sm == nullptr)
+    return FileTable::invalid;
+  auto info = getBufferInfo(sm->getFullyOriginalLoc(location).buffer());
+  if (info == nullptr)
+    return FileTable::invalid;
+  return info->file;
+}
+
+FileId SourcePositions::getBufferFile(slang::BufferID buffer) {
+  auto info = getBufferInfo(buffer);
+  if (info == nullptr)
+    return FileTable::invalid;
+  return info->file;
+}
+
+lsPosition SourcePositions::getPosition(slang::SourceLocation location) {
+  lsPosition position;
+  if (sm == nullptr)
+    return position;
+  auto file_location = sm->getFullyOriginalLoc(location);
+  auto info = getBufferInfo(file_location.buffer());
+  if (info == nullptr)
+    return position;
+  auto res = info->lines->positionAt(file_location.offset());
+  position.line = res.line;
+  position.character = res.character;
+  return position;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "FileTable.h"
+#include "LibLsp/lsp/lsRange.h"
+#include "LineIndex.h"
+#include <map>
+#include <memory>
+#include <slang/text/SourceLocation.h>
+
+class ProjectSources;
+namespace slang {
+class SourceManager;
+}
+
+// Converts slang locations to files and LSP positions. The file and line
+// index of each buffer are resolved once, macro expansions map to the text
+// they come from.
+class SourcePositions {
+public:
+  explicit SourcePositions(ProjectSources &project_sources);
+
+  // The cached buffers are dropped when the manager changes
+  void setSourceManager(const slang::SourceManager *source_manager);
+
+  // FileTable::invalid if the location is not in a file
+  FileId getFile(slang::SourceLocation location);
+  FileId getBufferFile(slang::BufferID buffer);
+  lsPosition getPosition(slang::SourceLocation location);
+
+private:
+  struct buffer_info {
+    FileId file;
+    std::shared_ptr<const LineIndex> lines;
+  };
+
+  const buffer_info *getBufferInfo(slang::BufferID buffer);
+
+  ProjectSources &sources;
+  const slang::SourceManager *sm;
+  std::map<uint32_t, buffer_info> buffers;
+};
@@ -1,10 +1,14 @@
+#include <exception>
 #include <iostream>
 #include <mutex>
+#include <string>
 
 #include "DiagnosticParser.h"
+#include "LibLsp/JsonRpc/Cancellation.h"
 #include "LibLsp/JsonRpc/Condition.h"
 #include "LibLsp/JsonRpc/Endpoint.h"
 #include "LibLsp/JsonRpc/RemoteEndPoint.h"
+#include "LibLsp/JsonRpc/lsResponseMessage.h"
 #include "LibLsp/JsonRpc/stream.h"
 #include "LibLsp/lsp/ProtocolJsonHandler.h"
 #include "LibLsp/lsp/general/exit.h"
@@ -12,31 +16,47 @@
 #include "LibLsp/lsp/general/initialized.h"
 #include "LibLsp/lsp/general/lsServerCapabilities.h"
 #include "LibLsp/lsp/general/lsTextDocumentClientCapabilities.h"
+#include "LibLsp/lsp/lsp_diagnostic.h"
 #include "LibLsp/lsp/textDocument/completion.h"
 #include "LibLsp/lsp/textDocument/declaration_definition.h"
 #include "LibLsp/lsp/workspace/did_change_configuration.h"
+#include "RequestDispatcher.h"
+#include "ServerStats.h"
 #include "dummyLog.h"
 #include "serverHandlers.h"
 
 class StdIOServer {
 public:
-  StdIOServer()
-      : remote_end_point_(protocol_json_handler, endpoint, _log, 1),
-        handlers(_log, remote_end_point_) {
+  // Serve the messages of a client from in to out. With a trace path, the
+  // requests and compilations are traced there.
+  explicit StdIOServer(std::istream &in = std::cin,
+                       std::ostream &out = std::cout,
+                       const std::string &trace_path = {})
+      : output(std::make_shared<ostream>(out)),
+        input(std::make_shared<istream>(in)),
+        remote_end_point_(protocol_json_handler, endpoint, _log, 1),
+        stats(trace_path), handlers(_log, remote_end_point_, stats) {
 
     remote_end_point_.registerHandler(
         [&](Notify_InitializedNotification::notify &notify) {
-          // Do nothoing with this for now
+          handlers.initializedHandler();
         });
 
     remote_end_point_.registerHandler([&](const td_initialize::request &req) {
       return handlers.initializeHandler(req);
     });
-
-    remote_end_point_.registerHandler([&](const td_completion::request &req) {
-      auto ret = handlers.completionHandler(req);
-      return ret;
-    });
+    // Read the capabilities LspCpp drops, before it parses the request
+    auto &parsers = protocol_json_handler->method2request;
+    auto parse_initialize = parsers[td_initialize::request::kMethodInfo];
+    parsers[td_initialize::request::kMethodInfo] =
+        [this, parse_initialize](Reader &visitor) {
+          auto extra =
+              sver_initializeCapabilities::request::ReflectReader(visitor);
+          handlers.setClientCapabilities(
+              static_cast<sver_initializeCapabilities::request &>(*extra)
+                  .params.capabilities);
+          return parse_initialize(visitor);
+        };
 
     remote_end_point_.registerHandler(
         [&](Notify_TextDocumentDidOpen::notify &notify) {
@@ -48,6 +68,11 @@ public:
           handlers.didModifyHandler(notify);
         });
 
+    remote_end_point_.registerHandler(
+        [&](Notify_TextDocumentDidSave::notify &notify) {
+          handlers.didSaveHandler(notify);
+        });
+
     remote_end_point_.registerHandler(
         [&](Notify_WorkspaceDidChangeConfiguration::notify &notify) {
           handlers.configChange(notify);
@@ -58,20 +83,167 @@ public:
       esc_event.notify(std::make_unique<bool>(true));
     });
 
-    remote_end_point_.registerHandler(
-        [&](const td_definition::request &req, const CancelMonitor &monitor) {
-          td_definition::response rsp;
-          rsp.result.first = std::vector<lsLocation>();
-          if (monitor && monitor()) {
-            _log.info("textDocument/definition request had been cancel.");
-          }
+    remote_end_point_.registerHandler([&](Notify_Cancellation::notify &notify) {
+      dispatcher.cancel(notify.params.id);
+    });
+
+    // Queries answered from the published analysis, they must stay quick
+    registerOnLane<td_completion::request>(
+        RequestDispatcher::interactive,
+        [&](const td_completion::request &req, const CancelMonitor &monitor) {
+          return handlers.completionHandler(req, monitor);
+        });
+
+    registerOnLane<td_diagnostic::request>(
+        RequestDispatcher::interactive,
+        [&](const td_diagnostic::request &req, const CancelMonitor &) {
+          return handlers.diagnosticHandler(req);
+        });
+
+    registerOnLane<td_definition::request>(
+        RequestDispatcher::interactive,
+        [&](const td_definition::request &req, const CancelMonitor &) {
+          return handlers.definitionHandler(req);
+        });
+
+    registerOnLane<td_typeDefinition::request>(
+        RequestDispatcher::interactive,
+        [&](const td_typeDefinition::request &req, const CancelMonitor &) {
+          return handlers.typeDefinitionHandler(req);
+        });
+
+    registerOnLane<td_references::request>(
+        RequestDispatcher::interactive,
+        [&](const td_references::request &req, const CancelMonitor &monitor) {
+          return handlers.referencesHandler(req, monitor);
+        });
+
+    registerOnLane<td_rename::request>(
+        RequestDispatcher::interactive,
+        [&](const td_rename::request &req, const CancelMonitor &) {
+          return handlers.renameHandler(req);
+        });
+
+    registerOnLane<wp_symbol::request>(
+        RequestDispatcher::interactive,
+        [&](const wp_symbol::request &req, const CancelMonitor &monitor) {
+          return handlers.workspaceSymbolHandler(req, monitor);
+        });
+
+    registerOnLane<td_syntaxSelectionRange::request>(
+        RequestDispatcher::interactive,
+        [&](const td_syntaxSelectionRange::request &req,
+            const CancelMonitor &) {
+          return handlers.selectionRangeHandler(req);
+        });
+
+    registerOnLane<sver_stats::request>(
+        RequestDispatcher::interactive,
+        [&](const sver_stats::request &req, const CancelMonitor &) {
+          sver_stats::response rsp;
+          rsp.result = getStats();
           return rsp;
         });
 
+    // These may parse a whole file again
+    registerOnLane<td_symbol::request>(
+        RequestDispatcher::background,
+        [&](const td_symbol::request &req, const CancelMonitor &) {
+          return handlers.documentSymbolHandler(req);
+        });
+
+    registerOnLane<td_foldingRange::request>(
+        RequestDispatcher::background,
+        [&](const td_foldingRange::request &req, const CancelMonitor &) {
+          return handlers.foldingRangeHandler(req);
+        });
+
+    // A single background worker keeps the deltas of a file in order
+    registerOnLane<td_semanticTokensFull::request>(
+        RequestDispatcher::background,
+        [&](const td_semanticTokensFull::request &req, const CancelMonitor &) {
+          return handlers.semanticTokensHandler(req);
+        });
+
+    registerOnLane<td_semanticTokensRange::request>(
+        RequestDispatcher::background,
+        [&](const td_semanticTokensRange::request &req,
+            const CancelMonitor &) {
+          return handlers.semanticTokensRangeHandler(req);
+        });
+
+    registerOnLane<td_semanticTokensDelta::request>(
+        RequestDispatcher::background,
+        [&](const td_semanticTokensDelta::request &req,
+            const CancelMonitor &) {
+          return handlers.semanticTokensDeltaHandler(req);
+        });
+
     remote_end_point_.startProcessingMessages(input, output);
   }
   ~StdIOServer() {}
 
+  // Latencies and memory usage so far, with the state of the lanes
+  ServerStatsReport getStats() const {
+    auto report = stats.getReport();
+    for (auto &lane : dispatcher.getStats()) {
+      LaneStats res;
+      res.name = lane.name;
+      res.workers = lane.workers;
+      res.queued = lane.queued;
+      res.running = lane.running;
+      res.completed = lane.completed;
+      res.meanWaitMs =
+          lane.completed ? lane.total_wait.count() / 1000.0 / lane.completed
+                         : 0;
+      res.maxWaitMs = lane.max_wait.count() / 1000.0;
+      report.lanes.push_back(std::move(res));
+    }
+    return report;
+  }
+
+  // Answer a request from a lane of the dispatcher. It is registered on the
+  // endpoint as usual, so the endpoint parses it, then the endpoint handler
+  // is replaced by one queueing it on the lane.
+  template <typename Request, typename Handler>
+  void registerOnLane(RequestDispatcher::lane_id lane, Handler handler) {
+    remote_end_point_.registerHandler(
+        [handler](const Request &req, const CancelMonitor &monitor) {
+          return handler(req, monitor);
+        });
+    endpoint->method2request[Request::kMethodInfo] =
+        [this, lane, handler](std::unique_ptr<LspMessage> msg) {
+          std::shared_ptr<Request> req(static_cast<Request *>(msg.release()));
+          auto arrival = ServerStats::clock::now();
+          dispatcher.post(
+              lane, req->id,
+              [this, req, handler, arrival](const CancelMonitor &monitor) {
+                auto start = ServerStats::clock::now();
+                // The client waits for an answer to every request
+                try {
+                  auto rsp = handler(*req, monitor);
+                  rsp.id = req->id;
+                  remote_end_point_.sendResponse(rsp);
+                } catch (const RequestError &e) {
+                  sendError(req->id, e.code, e.what());
+                } catch (const std::exception &e) {
+                  sendError(req->id, lsErrorCodes::InternalError, e.what());
+                }
+                stats.addRequest(Request::kMethodInfo, arrival, start);
+              });
+          return true;
+        };
+  }
+
+  void sendError(const lsRequestId &id, lsErrorCodes code,
+                 const std::string &message) {
+    Rsp_Error rsp;
+    rsp.id = id;
+    rsp.error.code = code;
+    rsp.error.message = message;
+    remote_end_point_.sendResponse(rsp);
+  }
+
   struct ostream : lsp::base_ostream<std::ostream> {
     explicit ostream(std::ostream &_t) : base_ostream<std::ostream>(_t) {}
 
@@ -86,12 +258,15 @@ public:
       std::make_shared<lsp::ProtocolJsonHandler>();
   DummyLog _log;
 
-  std::shared_ptr<ostream> output = std::make_shared<ostream>(std::cout);
-  std::shared_ptr<istream> input = std::make_shared<istream>(std::cin);
+  std::shared_ptr<ostream> output;
+  std::shared_ptr<istream> input;
 
   std::shared_ptr<GenericEndpoint> endpoint =
       std::make_shared<GenericEndpoint>(_log);
   RemoteEndPoint remote_end_point_;
   Condition<bool> esc_event;
+  ServerStats stats;
   ServerHandlers handlers;
+  // Declared last: its workers must stop before the handlers are destroyed
+  RequestDispatcher dispatcher;
 };
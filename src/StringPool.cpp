@@ -0,0 +1,32 @@
+#include "StringPool.h"
+#include <cstring>
+
+char *StringPool::allocate(size_t length) {
+  // Big strings get their own block, so they don't waste the current one
+  if (length > block_size / 4) {
+    large_blocks.emplace_back(new char[length]);
+    large_bytes += length;
+    return large_blocks.back().get();
+  }
+  if (used + length > block_size) {
+    blocks.emplace_back(new char[block_size]);
+    used = 0;
+  }
+  char *result = blocks.back().get() + used;
+  used += length;
+  return result;
+}
+
+std::string_view StringPool::intern(std::string_view str) {
+  if (str.empty())
+    return {};
+  auto res = strings.find(str);
+  if (res != strings.end())
+    return *res;
+
+  char *data = allocate(str.size());
+  std::memcpy(data, str.data(), str.size());
+  std::string_view interned(data, str.size());
+  strings.insert(interned);
+  return interned;
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <flat_hash_map.hpp>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Interned strings, stored back to back in large blocks. The views returned
+// by intern() are valid as long as the pool, and equal strings share them.
+class StringPool {
+public:
+  std::string_view intern(std::string_view str);
+  // Bytes allocated for the strings
+  size_t size() const { return blocks.size() * block_size + large_bytes; }
+  size_t count() const { return strings.size(); }
+
+private:
+  static constexpr size_t block_size = 64 * 1024;
+
+  char *allocate(size_t length);
+
+  std::vector<std::unique_ptr<char[]>> blocks, large_blocks;
+  size_t used = block_size;
+  size_t large_bytes = 0;
+  slang::flat_hash_set<std::string_view> strings;
+};
@@ -0,0 +1,178 @@
+#include "TextDocument.h"
+#include <algorithm>
+#include <atomic>
+
+static std::atomic<uint64_t> last_revision{0};
+
+TextDocument::TextDocument(std::string_view text) { setText(text); }
+
+void TextDocument::setText(std::string_view text) {
+  buffers.clear();
+  pieces.clear();
+  buffers.push_back(std::make_shared<const text_buffer>(text));
+  if (!text.empty())
+    pieces.push_back(makePiece(0, 0, text.size()));
+  length = text.size();
+  buffer_bytes = text.size();
+  reindex();
+  revision = ++last_revision;
+}
+
+TextDocument::piece TextDocument::makePiece(size_t buffer, size_t start,
+                                            size_t length) const {
+  auto &lines = buffers[buffer]->lines;
+  size_t newlines = lines.lineOf(start + length) - lines.lineOf(start);
+  return {buffer, start, length, newlines, 0, 0};
+}
+
+void TextDocument::reindex() {
+  size_t offset = 0, lines_before = 0;
+  for (auto &pc : pieces) {
+    pc.offset = offset;
+    pc.lines_before = lines_before;
+    offset += pc.length;
+    lines_before += pc.newlines;
+  }
+}
+
+size_t TextDocument::findPiece(size_t offset) const {
+  auto it = std::upper_bound(
+      pieces.begin(), pieces.end(), offset,
+      [](size_t value, const piece &pc) { return value < pc.offset; });
+  if (it == pieces.begin())
+    return pieces.size();
+  size_t index = it - pieces.begin() - 1;
+  auto &pc = pieces[index];
+  return offset < pc.offset + pc.length ? index : pieces.size();
+}
+
+void TextDocument::appendRange(std::vector<piece> &out, size_t from,
+                               size_t to) const {
+  size_t pos = 0;
+  for (auto &pc : pieces) {
+    size_t pc_end = pos + pc.length;
+    if (pc_end > from && pos < to) {
+      if (pos >= from && pc_end <= to) {
+        // The whole piece is in the range, keep it as it is
+        out.push_back(pc);
+      } else {
+        size_t start = std::max(pos, from);
+        size_t end = std::min(pc_end, to);
+        out.push_back(
+            makePiece(pc.buffer, pc.start + start - pos, end - start));
+      }
+    }
+    pos = pc_end;
+    if (pos >= to)
+      break;
+  }
+}
+
+void TextDocument::replace(size_t from, size_t to, std::string_view text) {
+  to = std::max(from, std::min(to, length));
+
+  std::vector<piece> result;
+  result.reserve(pieces.size() + 2);
+  appendRange(result, 0, from);
+  if (!text.empty()) {
+    buffers.push_back(std::make_shared<const text_buffer>(text));
+    buffer_bytes += text.size();
+    result.push_back(makePiece(buffers.size() - 1, 0, text.size()));
+  }
+  appendRange(result, to, length);
+
+  pieces = std::move(result);
+  length = length - (to - from) + text.size();
+  reindex();
+  revision = ++last_revision;
+
+  // Too many small edits make the lookups slow, and large replacements keep
+  // the old copies of the text alive: start over
+  if (pieces.size() > max_pieces ||
+      buffer_bytes > max_buffer_ratio * std::max(length, min_compact_size)) {
+    auto flat = materialize();
+    setText(std::string_view(flat.data(), length));
+  }
+}
+
+void TextDocument::applyChange(int start_line, int start_char, int end_line,
+                               int end_char, std::string_view text) {
+  size_t from = offsetAt(start_line, start_char);
+  size_t to = offsetAt(end_line, end_char);
+  replace(from, to, text);
+}
+
+void TextDocument::forEachChunk(
+    size_t from, const std::function<bool(std::string_view)> &fn) const {
+  for (size_t i = findPiece(from); i < pieces.size(); i++) {
+    auto &pc = pieces[i];
+    size_t skip = from > pc.offset ? from - pc.offset : 0;
+    std::string_view chunk(buffers[pc.buffer]->text.data() + pc.start + skip,
+                           pc.length - skip);
+    if (!fn(chunk))
+      return;
+  }
+}
+
+size_t TextDocument::lineStart(int line) const {
+  if (line <= 0)
+    return 0;
+
+  // First piece holding the newline that ends the previous line
+  size_t target = line;
+  auto it = std::lower_bound(pieces.begin(), pieces.end(), target,
+                             [](const piece &pc, size_t value) {
+                               return pc.lines_before + pc.newlines < value;
+                             });
+  // Past the last line
+  if (it == pieces.end())
+    return length;
+
+  // Find the line start in the line index of the piece's buffer
+  auto &lines = buffers[it->buffer]->lines;
+  size_t buffer_line = lines.lineOf(it->start) + (target - it->lines_before);
+  return it->offset + lines.lineStart(buffer_line) - it->start;
+}
+
+size_t TextDocument::offsetAt(int line, int character) const {
+  size_t offset = lineStart(line);
+  int units = 0;
+
+  // Advance the UTF-16 units, without going past the end of the line
+  forEachChunk(offset, [&](std::string_view chunk) {
+    for (unsigned char c : chunk) {
+      if ((c & 0xC0) != 0x80) {
+        // Start of a code point
+        if (units >= character || c == '\n')
+          return false;
+        // Code points outside the BMP take two UTF-16 units
+        units += c >= 0xF0 ? 2 : 1;
+      }
+      offset++;
+    }
+    return true;
+  });
+
+  return offset;
+}
+
+std::vector<char> TextDocument::materialize() const {
+  std::vector<char> result;
+  result.reserve(length + 1);
+  for (auto &pc : pieces) {
+    auto data = buffers[pc.buffer]->text.data() + pc.start;
+    result.insert(result.end(), data, data + pc.length);
+  }
+  result.push_back('\0');
+  return result;
+}
+
+std::string TextDocument::getLine(int line) const {
+  std::string result;
+  forEachChunk(lineStart(line), [&](std::string_view chunk) {
+    auto end = chunk.find('\n');
+    result.append(chunk.substr(0, end));
+    return end == std::string_view::npos;
+  });
+  return result;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "LineIndex.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Piece table holding the contents of a file opened in the editor.
+// Edits never copy the existing text: the inserted text gets its own buffer
+// and the pieces are updated to point to it. Buffers are immutable and
+// shared, so copying a document to hand it to a compilation is cheap.
+class TextDocument {
+public:
+  TextDocument(std::string_view text = "");
+
+  // Replace the whole contents
+  void setText(std::string_view text);
+  // Replace the text between two LSP positions (lines and UTF-16 units)
+  void applyChange(int start_line, int start_char, int end_line, int end_char,
+                   std::string_view text);
+
+  // Contents as a single null-terminated buffer, as slang expects them
+  std::vector<char> materialize() const;
+  // Contents of a line, without the line ending
+  std::string getLine(int line) const;
+  size_t size() const { return length; }
+  // Changes every time the contents are modified
+  uint64_t getRevision() const { return revision; }
+
+private:
+  // Immutable text, with the line index used to find the lines in a piece
+  struct text_buffer {
+    explicit text_buffer(std::string_view contents)
+        : text(contents), lines(text) {}
+    const std::string text;
+    const LineIndex lines;
+  };
+
+  struct piece {
+    size_t buffer, start, length, newlines;
+    // Position of the piece in the document, set by reindex()
+    size_t offset, lines_before;
+  };
+
+  // Pieces above which the document is flattened into a single buffer
+  static constexpr size_t max_pieces = 1024;
+  // Same when the buffers hold this many times the text, as the replaced
+  // ones are kept. Small documents are left alone below min_compact_size.
+  static constexpr size_t max_buffer_ratio = 4;
+  static constexpr size_t min_compact_size = 4096;
+
+  piece makePiece(size_t buffer, size_t start, size_t length) const;
+  void appendRange(std::vector<piece> &out, size_t from, size_t to) const;
+  void replace(size_t from, size_t to, std::string_view text);
+  void reindex();
+  // Piece containing an offset, pieces.size() past the end
+  size_t findPiece(size_t offset) const;
+  // Call fn with the text from the given offset on, until it returns false
+  void forEachChunk(size_t from,
+                    const std::function<bool(std::string_view)> &fn) const;
+  size_t lineStart(int line) const;
+  size_t offsetAt(int line, int character) const;
+
+  std::vector<std::shared_ptr<const text_buffer>> buffers;
+  std::vector<piece> pieces;
+  size_t length;
+  // Total size of the buffers, referenced by the pieces or not
+  size_t buffer_bytes;
+  uint64_t revision;
+};
@@ -0,0 +1,80 @@
+#include "TraceWriter.h"
+#include <fmt/core.h>
+
+static thread_local const char *thread_name = nullptr;
+
+TraceWriter::TraceWriter(const std::string &path)
+    : out(path), origin(clock::now()), first_event(true) {
+  if (out.is_open())
+    out << "{\"traceEvents\":[\n";
+}
+
+TraceWriter::~TraceWriter() {
+  if (out.is_open())
+    out << "\n]}\n";
+}
+
+void TraceWriter::setThreadName(const char *name) { thread_name = name; }
+
+void TraceWriter::addEvent(std::string_view name, std::string_view category,
+                           clock::time_point start, clock::time_point end,
+                           const event_args &args) {
+  if (!out.is_open())
+    return;
+  auto ts = std::chrono::duration_cast<std::chrono::microseconds>(start -
+                                                                  origin);
+  auto dur = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  uint64_t tid = getThreadId();
+  out << (first_event ? "" : ",\n") << "{\"name\":";
+  first_event = false;
+  writeString(name);
+  out << ",\"cat\":";
+  writeString(category);
+  out << fmt::format(",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{},\"dur\":{}",
+                     tid, ts.count(), dur.count());
+  if (!args.empty()) {
+    out << ",\"args\":{";
+    for (size_t i = 0; i < args.size(); i++) {
+      if (i > 0)
+        out << ",";
+      writeString(args[i].first);
+      out << ":";
+      writeString(args[i].second);
+    }
+    out << "}";
+  }
+  out << "}";
+  out.flush();
+}
+
+// The metadata naming a thread comes before its first event
+uint64_t TraceWriter::getThreadId() {
+  auto [res, inserted] =
+      threads.emplace(std::this_thread::get_id(), threads.size() + 1);
+  if (inserted) {
+    out << (first_event ? "" : ",\n")
+        << fmt::format("{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                       "\"tid\":{},\"args\":{{\"name\":",
+                       res->second);
+    first_event = false;
+    writeString(thread_name ? thread_name
+                            : fmt::format("thread {}", res->second));
+    out << "}}";
+  }
+  return res->second;
+}
+
+void TraceWriter::writeString(std::string_view text) {
+  out << '"';
+  for (char c : text) {
+    if (c == '"' || c == '\\')
+      out << '\\' << c;
+    else if (static_cast<unsigned char>(c) < 0x20)
+      out << fmt::format("\\u{:04x}", static_cast<unsigned>(c));
+    else
+      out << c;
+  }
+  out << '"';
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Writes timed events in the trace event format of Chrome, which Perfetto
+// and chrome://tracing load. The events are written as they end, so the
+// trace of a crashed session can still be read.
+class TraceWriter {
+public:
+  typedef std::chrono::steady_clock clock;
+  typedef std::vector<std::pair<std::string_view, std::string>> event_args;
+
+  explicit TraceWriter(const std::string &path);
+  ~TraceWriter();
+
+  bool isOpen() const { return out.is_open(); }
+  // An event on the calling thread, from start to end
+  void addEvent(std::string_view name, std::string_view category,
+                clock::time_point start, clock::time_point end,
+                const event_args &args = {});
+
+  // Name of the calling thread in the traces, set before its first event
+  static void setThreadName(const char *name);
+
+private:
+  uint64_t getThreadId();
+  void writeString(std::string_view text);
+
+  std::mutex mutex;
+  std::ofstream out;
+  clock::time_point origin;
+  bool first_event;
+  // Small numbers are easier to read than the system ids
+  std::map<std::thread::id, uint64_t> threads;
+};
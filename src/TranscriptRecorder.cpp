@@ -0,0 +1,51 @@
+#include "TranscriptRecorder.h"
+
+TranscriptRecorder::TranscriptRecorder(std::streambuf *source,
+                                       const std::string &path)
+    : source(source), out(path, std::ios::binary), origin(clock::now()) {}
+
+TranscriptRecorder::~TranscriptRecorder() {
+  if (!chunk.empty())
+    writeChunk();
+}
+
+TranscriptRecorder::int_type TranscriptRecorder::underflow() {
+  // Block for the first byte, then take what is already there
+  int_type c = source->sbumpc();
+  if (traits_type::eq_int_type(c, traits_type::eof())) {
+    if (!chunk.empty())
+      writeChunk();
+    return c;
+  }
+  size_t size = 0;
+  buffer[size++] = traits_type::to_char_type(c);
+  while (size < sizeof(buffer) && source->in_avail() > 0)
+    buffer[size++] = traits_type::to_char_type(source->sbumpc());
+
+  record(buffer, size);
+  setg(buffer, buffer, buffer + size);
+  return traits_type::to_int_type(buffer[0]);
+}
+
+// Unbuffered sources give a byte at a time, so the bytes are grouped until
+// the client pauses
+void TranscriptRecorder::record(const char *data, size_t size) {
+  auto now = clock::now();
+  if (!chunk.empty() && now - last_read > chunk_gap)
+    writeChunk();
+  if (chunk.empty())
+    chunk_time = now;
+  chunk.append(data, size);
+  last_read = now;
+}
+
+void TranscriptRecorder::writeChunk() {
+  if (out.is_open()) {
+    auto time = std::chrono::duration_cast<std::chrono::microseconds>(
+        chunk_time - origin);
+    out << '@' << time.count() << ' ' << chunk.size() << '\n'
+        << chunk << '\n';
+    out.flush();
+  }
+  chunk.clear();
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <chrono>
+#include <fstream>
+#include <streambuf>
+#include <string>
+
+// Reads the messages of the client from another stream buffer, and copies
+// them to a transcript with their time of arrival, for sver-replay. The
+// bytes arriving together are written as a chunk:
+//   @<microseconds since the start> <length>\n<bytes>\n
+class TranscriptRecorder : public std::streambuf {
+public:
+  TranscriptRecorder(std::streambuf *source, const std::string &path);
+  ~TranscriptRecorder();
+
+  bool isOpen() const { return out.is_open(); }
+
+protected:
+  int_type underflow() override;
+
+private:
+  typedef std::chrono::steady_clock clock;
+
+  void record(const char *data, size_t size);
+  void writeChunk();
+
+  // Reads closer than this belong to the same chunk
+  static constexpr std::chrono::milliseconds chunk_gap{1};
+
+  std::streambuf *source;
+  std::ofstream out;
+  clock::time_point origin, last_read;
+  // Chunk not written yet, it may still grow
+  std::string chunk;
+  clock::time_point chunk_time;
+  char buffer[4096];
+};
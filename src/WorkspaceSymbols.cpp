@@ -0,0 +1,404 @@
+#include "WorkspaceSymbols.h"
+#include "FuzzyMatch.h"
+#include "LibLsp/lsp/AbsolutePath.h"
+#include "LineIndex.h"
+#include <algorithm>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <cctype>
+#include <slang/syntax/AllSyntax.h>
+#include <slang/syntax/SyntaxTree.h>
+#include <slang/syntax/SyntaxVisitor.h>
+#include <slang/text/SourceManager.h>
+
+const std::vector<std::string> WorkspaceSymbols::extensions = {".v", ".sv",
+                                                               ".vh", ".svh"};
+
+// Lowercase trigram packed in a number
+static uint32_t makeTrigram(std::string_view text, size_t pos) {
+  uint32_t res = 0;
+  for (size_t i = pos; i < pos + 3; i++)
+    res = res << 8 | static_cast<uint8_t>(
+                     std::tolower(static_cast<unsigned char>(text[i])));
+  return res;
+}
+
+// Distinct trigrams of a text, sorted
+static std::vector<uint32_t> getTrigrams(std::string_view text) {
+  std::vector<uint32_t> res;
+  for (size_t pos = 0; pos + 3 <= text.size(); pos++)
+    res.push_back(makeTrigram(text, pos));
+  std::sort(res.begin(), res.end());
+  res.erase(std::unique(res.begin(), res.end()), res.end());
+  return res;
+}
+
+// Collects the declarations worth looking up from a syntax tree
+class DeclarationCollector
+    : public slang::SyntaxVisitor<DeclarationCollector> {
+public:
+  DeclarationCollector(const LineIndex &lines,
+                       std::vector<WorkspaceSymbols::symbol> &symbols)
+      : lines(lines), symbols(symbols) {}
+
+  void handle(const slang::ModuleDeclarationSyntax &syntax) {
+    lsSymbolKind kind = lsSymbolKind::Module;
+    if (syntax.kind == slang::SyntaxKind::PackageDeclaration)
+      kind = lsSymbolKind::Package;
+    else if (syntax.kind == slang::SyntaxKind::InterfaceDeclaration)
+      kind = lsSymbolKind::Interface;
+    addScope(syntax, syntax.header->name, kind);
+  }
+
+  void handle(const slang::ClassDeclarationSyntax &syntax) {
+    addScope(syntax, syntax.name, lsSymbolKind::Class);
+  }
+
+  void handle(const slang::TypedefDeclarationSyntax &syntax) {
+    add(syntax.name, lsSymbolKind::TypeParameter);
+  }
+
+  // Nothing to look up inside the body
+  void handle(const slang::FunctionDeclarationSyntax &syntax) {
+    auto name = syntax.prototype->name->getLastToken();
+    add(name, in_class ? lsSymbolKind::Method : lsSymbolKind::Function);
+  }
+
+private:
+  template <typename T>
+  void addScope(const T &syntax, slang::Token name, lsSymbolKind kind) {
+    add(name, kind);
+    auto outer = container;
+    bool outer_class = in_class;
+    container = std::string(name.valueText());
+    in_class = kind == lsSymbolKind::Class;
+    visitDefault(syntax);
+    container = std::move(outer);
+    in_class = outer_class;
+  }
+
+  void add(slang::Token name, lsSymbolKind kind) {
+    auto text = name.valueText();
+    if (text.empty())
+      return;
+    WorkspaceSymbols::symbol sym;
+    sym.name = std::string(text);
+    sym.container = container;
+    sym.kind = kind;
+    auto pos = lines.positionAt(name.location().offset());
+    sym.range.start.line = pos.line;
+    sym.range.start.character = pos.character;
+    sym.range.end = sym.range.start;
+    sym.range.end.character += LineIndex::utf16Length(text);
+    symbols.push_back(std::move(sym));
+  }
+
+  const LineIndex &lines;
+  std::vector<WorkspaceSymbols::symbol> &symbols;
+  std::string container;
+  bool in_class = false;
+};
+
+WorkspaceSymbols::WorkspaceSymbols()
+    : stopping(false), worker([this]() { run(); }) {}
+
+WorkspaceSymbols::~WorkspaceSymbols() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  cv.notify_all();
+  worker.join();
+}
+
+void WorkspaceSymbols::update(const std::set<fs::path> &directories) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (directories == indexed_directories)
+      return;
+    indexed_directories = directories;
+    pending_scan = directories;
+  }
+  cv.notify_all();
+}
+
+void WorkspaceSymbols::refreshFile(const fs::path &path) {
+  if (std::find(extensions.begin(), extensions.end(),
+                path.extension().string()) == extensions.end())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending_files.insert(path);
+  }
+  cv.notify_all();
+}
+
+void WorkspaceSymbols::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    cv.wait(lock, [this]() {
+      return stopping || pending_scan || !pending_files.empty();
+    });
+    if (stopping)
+      return;
+
+    if (pending_scan) {
+      auto directories = std::move(*pending_scan);
+      pending_scan.reset();
+      lock.unlock();
+      scan(directories);
+      lock.lock();
+      continue;
+    }
+
+    auto paths = std::move(pending_files);
+    pending_files.clear();
+    lock.unlock();
+    refresh(paths);
+    lock.lock();
+  }
+}
+
+void WorkspaceSymbols::scan(const std::set<fs::path> &directories) {
+  // A newer scan or the destruction makes this one useless
+  auto abandoned = [this]() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stopping || pending_scan.has_value();
+  };
+
+  // Directories inside another one are already walked with it
+  auto nested = [&](const fs::path &dir) {
+    return std::any_of(directories.begin(), directories.end(),
+                       [&](const fs::path &other) {
+                         auto rel = dir.lexically_relative(other);
+                         return !rel.empty() && rel != "." &&
+                                *rel.begin() != "..";
+                       });
+  };
+
+  std::set<fs::path> paths;
+  for (auto &dir : directories) {
+    if (nested(dir))
+      continue;
+    std::error_code ec;
+    auto it = fs::recursive_directory_iterator(
+        dir, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+      const auto &path = it->path();
+      std::error_code type_ec;
+      if (it->is_directory(type_ec)) {
+        auto name = path.filename().string();
+        if (!name.empty() && name[0] == '.')
+          it.disable_recursion_pending();
+        continue;
+      }
+      if (std::find(extensions.begin(), extensions.end(),
+                    path.extension().string()) != extensions.end() &&
+          it->is_regular_file(type_ec))
+        paths.insert(path);
+    }
+  }
+
+  // Parse them on all the cores, each task fills its own slot
+  std::vector<fs::path> list(paths.begin(), paths.end());
+  std::vector<std::shared_ptr<const file_symbols>> results(list.size());
+  {
+    boost::asio::thread_pool pool;
+    for (size_t i = 0; i < list.size(); i++) {
+      boost::asio::post(pool, [&, i]() {
+        if (!abandoned())
+          results[i] = scanFile(list[i]);
+      });
+    }
+    pool.join();
+  }
+  if (abandoned())
+    return;
+
+  std::map<fs::path, std::shared_ptr<const file_symbols>> files;
+  for (size_t i = 0; i < list.size(); i++) {
+    if (results[i] != nullptr)
+      files.emplace(list[i], std::move(results[i]));
+  }
+  std::atomic_store(&data, build(std::move(files)));
+}
+
+void WorkspaceSymbols::refresh(const std::set<fs::path> &paths) {
+  auto current = std::atomic_load(&data);
+  if (current == nullptr)
+    return;
+  auto res = std::make_shared<index_data>(*current);
+
+  // Lists changed by this refresh, copied from the current ones
+  slang::flat_hash_map<uint32_t, std::vector<uint32_t>> edited;
+  auto edit = [&](uint32_t trigram) -> std::vector<uint32_t> & {
+    auto found = edited.find(trigram);
+    if (found != edited.end())
+      return found->second;
+    auto &list = edited[trigram];
+    auto old = res->trigrams.find(trigram);
+    if (old != res->trigrams.end())
+      list = *old->second;
+    return list;
+  };
+
+  for (auto &path : paths) {
+    // The old entries stay as holes, the new ones go at the end
+    auto old = res->files.find(path);
+    if (old != res->files.end()) {
+      uint32_t first = res->first_entry.at(path);
+      for (uint32_t i = first; i < first + old->second->symbols.size(); i++) {
+        for (auto trigram : getTrigrams(res->entries[i].sym->name)) {
+          auto &list = edit(trigram);
+          list.erase(std::remove(list.begin(), list.end(), i), list.end());
+        }
+        res->entries[i].file = nullptr;
+        res->removed_entries++;
+      }
+      res->files.erase(old);
+      res->first_entry.erase(path);
+    }
+
+    auto file = scanFile(path);
+    if (file == nullptr)
+      continue;
+    res->files[path] = file;
+    res->first_entry[path] = res->entries.size();
+    for (auto &sym : file->symbols) {
+      uint32_t i = res->entries.size();
+      res->entries.push_back({file.get(), &sym});
+      for (auto trigram : getTrigrams(sym.name))
+        edit(trigram).push_back(i);
+    }
+  }
+
+  for (auto &[trigram, list] : edited) {
+    if (list.empty())
+      res->trigrams.erase(trigram);
+    else
+      res->trigrams[trigram] =
+          std::make_shared<const std::vector<uint32_t>>(std::move(list));
+  }
+  // Too many holes slow down the short queries, start over
+  std::shared_ptr<const index_data> next = res;
+  if (res->removed_entries > res->entries.size() / 2)
+    next = build(std::move(res->files));
+  std::atomic_store(&data, next);
+}
+
+std::shared_ptr<const WorkspaceSymbols::file_symbols>
+WorkspaceSymbols::scanFile(const fs::path &path) {
+  // A SourceManager per file, so the buffers are freed with it
+  slang::SourceManager sm;
+  auto buffer = sm.readSource(path.string());
+  if (!buffer)
+    return nullptr;
+  auto tree = slang::SyntaxTree::fromBuffer(buffer, sm);
+  LineIndex lines(buffer.data);
+
+  auto res = std::make_shared<file_symbols>();
+  res->path = path;
+  DeclarationCollector collector(lines, res->symbols);
+  collector.visit(tree->root());
+  res->symbols.shrink_to_fit();
+  return res;
+}
+
+std::shared_ptr<const WorkspaceSymbols::index_data> WorkspaceSymbols::build(
+    std::map<fs::path, std::shared_ptr<const file_symbols>> files) {
+  auto res = std::make_shared<index_data>();
+  res->files = std::move(files);
+  for (auto &[path, file] : res->files) {
+    res->first_entry[path] = res->entries.size();
+    for (auto &sym : file->symbols)
+      res->entries.push_back({file.get(), &sym});
+  }
+
+  // Entries are added in order, so the lists come out sorted
+  slang::flat_hash_map<uint32_t, std::vector<uint32_t>> trigrams;
+  for (uint32_t i = 0; i < res->entries.size(); i++)
+    for (auto trigram : getTrigrams(res->entries[i].sym->name))
+      trigrams[trigram].push_back(i);
+  for (auto &[trigram, list] : trigrams)
+    res->trigrams[trigram] =
+        std::make_shared<const std::vector<uint32_t>>(std::move(list));
+  return res;
+}
+
+std::vector<lsSymbolInformation>
+WorkspaceSymbols::find(std::string_view query, size_t limit,
+                       const std::function<bool()> &abandoned) const {
+  std::vector<lsSymbolInformation> result;
+  auto current = std::atomic_load(&data);
+  if (current == nullptr)
+    return result;
+
+  struct candidate {
+    int score;
+    uint32_t entry;
+  };
+  std::vector<candidate> candidates;
+  // Checked every few entries, a short query can match the whole index
+  bool stopped = false;
+  size_t checked = 0;
+  auto check = [&](uint32_t entry) {
+    if (++checked % 1024 == 0 && abandoned && abandoned())
+      stopped = true;
+    if (stopped || current->entries[entry].file == nullptr)
+      return;
+    int score = fuzzyMatch(query, current->entries[entry].sym->name);
+    if (score >= 0)
+      candidates.push_back({score, entry});
+  };
+
+  if (query.size() < 3) {
+    for (uint32_t i = 0; i < current->entries.size(); i++)
+      check(i);
+  } else {
+    // Count the trigrams each name shares with the query, a third of them is
+    // enough to keep the fuzzy matches like "fifoctl" for "fifo_ctrl"
+    auto query_trigrams = getTrigrams(query);
+    size_t min_overlap = std::min<size_t>((query_trigrams.size() + 2) / 3,
+                                          UINT16_MAX);
+    std::vector<uint16_t> overlap(current->entries.size());
+    std::vector<uint32_t> entries;
+    for (auto trigram : query_trigrams) {
+      auto res = current->trigrams.find(trigram);
+      if (res == current->trigrams.end())
+        continue;
+      for (auto entry : *res->second)
+        if (overlap[entry] < min_overlap && ++overlap[entry] == min_overlap)
+          entries.push_back(entry);
+    }
+    for (auto entry : entries)
+      check(entry);
+  }
+  if (stopped)
+    return result;
+
+  // Best matches first, keep only the ones that are sent
+  auto last = candidates.end();
+  if (candidates.size() > limit)
+    last = candidates.begin() + limit;
+  std::partial_sort(candidates.begin(), last, candidates.end(),
+                    [&](const candidate &a, const candidate &b) {
+                      if (a.score != b.score)
+                        return a.score > b.score;
+                      return current->entries[a.entry].sym->name <
+                             current->entries[b.entry].sym->name;
+                    });
+  candidates.erase(last, candidates.end());
+
+  for (auto &cand : candidates) {
+    auto &entry = current->entries[cand.entry];
+    lsSymbolInformation info;
+    info.name = entry.sym->name;
+    info.kind = entry.sym->kind;
+    info.location.uri.SetPath(AbsolutePath(entry.file->path.string()));
+    info.location.range = entry.sym->range;
+    if (!entry.sym->container.empty())
+      info.containerName = entry.sym->container;
+    result.push_back(std::move(info));
+  }
+  return result;
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include "LibLsp/lsp/lsRange.h"
+#include "LibLsp/lsp/symbol.h"
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <flat_hash_map.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+class DeclarationCollector;
+
+// Names of the modules, packages, interfaces, classes, typedefs, functions
+// and tasks of every source file in the workspace. The files are parsed on a
+// background thread without elaborating, so the index does not depend on
+// what the compilation reaches. Lookups use a trigram index of the names.
+class WorkspaceSymbols {
+public:
+  WorkspaceSymbols();
+  ~WorkspaceSymbols();
+
+  // Scan the directories again, if they changed since the last time. They
+  // are searched recursively, skipping the hidden ones.
+  void update(const std::set<fs::path> &directories);
+  // Parse a file again, after it was saved
+  void refreshFile(const fs::path &path);
+
+  // Names matching the query fuzzily ignoring the case, best matches first.
+  // Only the names sharing a third of the trigrams of the query are checked,
+  // queries shorter than a trigram check all the names. Nothing is found
+  // once abandoned() is true.
+  std::vector<lsSymbolInformation>
+  find(std::string_view query, size_t limit,
+       const std::function<bool()> &abandoned = nullptr) const;
+
+  static const std::vector<std::string> extensions;
+
+private:
+  friend class DeclarationCollector;
+
+  struct symbol {
+    std::string name, container;
+    lsSymbolKind kind;
+    lsRange range;
+  };
+
+  struct file_symbols {
+    fs::path path;
+    std::vector<symbol> symbols;
+  };
+
+  // Never modified once published, the files and the lists of trigrams are
+  // shared with the next ones
+  struct index_data {
+    std::map<fs::path, std::shared_ptr<const file_symbols>> files;
+    struct entry {
+      // nullptr once the file is parsed again
+      const file_symbols *file;
+      const symbol *sym;
+    };
+    std::vector<entry> entries;
+    // First entry of each file, its symbols follow in order
+    std::map<fs::path, uint32_t> first_entry;
+    size_t removed_entries = 0;
+    // Entries whose name contains each trigram, sorted
+    slang::flat_hash_map<uint32_t, std::shared_ptr<const std::vector<uint32_t>>>
+        trigrams;
+  };
+
+  void run();
+  // Stops early if a newer scan is requested
+  void scan(const std::set<fs::path> &directories);
+  // Only the lists of the trigrams of the old and new names are changed
+  void refresh(const std::set<fs::path> &paths);
+  static std::shared_ptr<const file_symbols> scanFile(const fs::path &path);
+  static std::shared_ptr<const index_data>
+  build(std::map<fs::path, std::shared_ptr<const file_symbols>> files);
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool stopping;
+  std::set<fs::path> indexed_directories;
+  std::optional<std::set<fs::path>> pending_scan;
+  std::set<fs::path> pending_files;
+  // Only accessed through std::atomic_load/atomic_store
+  std::shared_ptr<const index_data> data;
+  // Declared last, so it starts after the rest is initialized
+  std::thread worker;
+};
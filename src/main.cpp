@@ -1,7 +1,9 @@
 #include <boost/program_options.hpp>
 #include <iostream>
+#include <memory>
 
 #include "StdIOServer.h"
+#include "TranscriptRecorder.h"
 
 using namespace std;
 namespace po = boost::program_options;
@@ -9,7 +11,14 @@ namespace po = boost::program_options;
 int main(int argc, char *argv[]) {
   // Declare the supported options.
   po::options_description desc("Allowed options");
-  desc.add_options()("help", "produce help message");
+  desc.add_options()("help", "produce help message")(
+      "stats", "print the request and compilation timings on exit")(
+      "trace", po::value<std::string>(),
+      "write a trace of the requests and compilations to this file, "
+      "to open in Perfetto or chrome://tracing")(
+      "record", po::value<std::string>(),
+      "copy the messages of the client to this file, with their timing, "
+      "to replay them with sver-replay");
 
   po::variables_map vm;
   po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -21,8 +30,29 @@ int main(int argc, char *argv[]) {
   }
 
   // start the server
-  StdIOServer server;
+  std::string trace_path;
+  if (vm.count("trace"))
+    trace_path = vm["trace"].as<std::string>();
+  // Read the client through the recorder, it copies what it reads
+  std::unique_ptr<TranscriptRecorder> recorder;
+  std::unique_ptr<std::istream> recorded_input;
+  std::istream *input = &std::cin;
+  if (vm.count("record")) {
+    auto record_path = vm["record"].as<std::string>();
+    recorder =
+        std::make_unique<TranscriptRecorder>(std::cin.rdbuf(), record_path);
+    if (recorder->isOpen()) {
+      recorded_input = std::make_unique<std::istream>(recorder.get());
+      input = recorded_input.get();
+    } else {
+      cerr << "Cannot record the session to " << record_path << endl;
+    }
+  }
+  StdIOServer server(*input, std::cout, trace_path);
   server.esc_event.wait();
 
+  if (vm.count("stats"))
+    ServerStats::print(server.getStats(), std::cerr);
+
   return 0;
 }
@@ -0,0 +1,348 @@
+// Replays a recorded LSP session into a server running in this process, and
+// reports the latency of its requests. The transcript is either the raw input
+// of a client, as saved by wrapper.sh, or a recording of sver --record, which
+// also has the time of each message.
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <fmt/core.h>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <rapidjson/document.h>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+#include "ServerStats.h"
+#include "StdIOServer.h"
+
+namespace po = boost::program_options;
+typedef std::chrono::steady_clock replay_clock;
+
+struct client_message {
+  // Arrival since the start of the session
+  std::chrono::microseconds time;
+  std::string content;
+};
+
+// Split the input of a client in messages. A message is timed by the chunk
+// holding its last byte, when the server could read it whole.
+static std::vector<client_message> readTranscript(std::istream &in) {
+  std::string stream;
+  std::vector<std::pair<size_t, std::chrono::microseconds>> chunk_ends;
+  if (in.peek() == '@') {
+    while (in.peek() == '@') {
+      int64_t time;
+      size_t size;
+      in.get();
+      in >> time >> size;
+      in.get();
+      std::string data(size, '\0');
+      in.read(data.data(), size);
+      in.get();
+      if (!in)
+        break;
+      stream += data;
+      chunk_ends.emplace_back(stream.size(), std::chrono::microseconds(time));
+    }
+  } else {
+    stream.assign(std::istreambuf_iterator<char>(in), {});
+    chunk_ends.emplace_back(stream.size(), std::chrono::microseconds(0));
+  }
+
+  std::vector<client_message> messages;
+  size_t pos = 0, chunk = 0;
+  while (true) {
+    auto header_end = stream.find("\r\n\r\n", pos);
+    if (header_end == std::string::npos)
+      break;
+    // Content-Length is the only header needed
+    auto headers = stream.substr(pos, header_end - pos);
+    auto length_pos = headers.find("Content-Length:");
+    if (length_pos == std::string::npos)
+      break;
+    size_t length = std::stoul(headers.substr(length_pos + 15));
+    size_t start = header_end + 4;
+    if (start + length > stream.size())
+      break;
+    pos = start + length;
+    while (chunk_ends[chunk].first < pos)
+      chunk++;
+    messages.push_back(
+        {chunk_ends[chunk].second, stream.substr(start, length)});
+  }
+  return messages;
+}
+
+static std::string frame(const std::string &content) {
+  return fmt::format("Content-Length: {}\r\n\r\n{}", content.size(), content);
+}
+
+// Requests and responses are matched by their id
+static std::string getIdKey(const rapidjson::Value &id) {
+  if (id.IsString())
+    return fmt::format("\"{}\"", id.GetString());
+  if (id.IsInt64())
+    return std::to_string(id.GetInt64());
+  return {};
+}
+
+// Input of the server, written by the replay
+class PipeBuffer : public std::streambuf {
+public:
+  void write(const std::string &data) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending += data;
+    cv.notify_all();
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    cv.notify_all();
+  }
+
+protected:
+  int_type underflow() override {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&]() { return closed || !pending.empty(); });
+    if (pending.empty())
+      return traits_type::eof();
+    current.swap(pending);
+    pending.clear();
+    setg(current.data(), current.data(), current.data() + current.size());
+    return traits_type::to_int_type(current[0]);
+  }
+
+private:
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::string pending, current;
+  bool closed = false;
+};
+
+// Output of the server, where the responses to the requests are timed
+class ResponseCollector : public std::streambuf {
+public:
+  void sent(const std::string &key, const std::string &method) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending[key] = {method, replay_clock::now()};
+  }
+
+  // False if some requests are still not answered after the timeout
+  bool waitAnswers(std::chrono::seconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return cv.wait_for(lock, timeout, [&]() { return pending.empty(); });
+  }
+
+  // In milliseconds, by method
+  std::map<std::string, std::vector<double>> getLatencies() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return latencies;
+  }
+
+  std::vector<std::string> getUnanswered() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> res;
+    for (auto &[key, req] : pending)
+      res.push_back(req.method + " " + key);
+    return res;
+  }
+
+protected:
+  int_type overflow(int_type c) override {
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      std::lock_guard<std::mutex> lock(mutex);
+      received += traits_type::to_char_type(c);
+      parse();
+    }
+    return traits_type::not_eof(c);
+  }
+
+  std::streamsize xsputn(const char *data, std::streamsize size) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    received.append(data, size);
+    parse();
+    return size;
+  }
+
+private:
+  struct request {
+    std::string method;
+    replay_clock::time_point sent;
+  };
+
+  // Take the complete messages out of the received data
+  void parse() {
+    while (true) {
+      auto header_end = received.find("\r\n\r\n");
+      if (header_end == std::string::npos)
+        return;
+      auto length_pos = received.find("Content-Length:");
+      if (length_pos == std::string::npos || length_pos > header_end)
+        return;
+      size_t length = std::stoul(received.substr(length_pos + 15));
+      size_t start = header_end + 4;
+      if (start + length > received.size())
+        return;
+      handle(received.substr(start, length));
+      received.erase(0, start + length);
+    }
+  }
+
+  // Only the responses matter, they have an id but no method
+  void handle(const std::string &content) {
+    rapidjson::Document doc;
+    doc.Parse(content.data(), content.size());
+    if (doc.HasParseError() || !doc.IsObject() || doc.HasMember("method") ||
+        !doc.HasMember("id"))
+      return;
+    auto res = pending.find(getIdKey(doc["id"]));
+    if (res == pending.end())
+      return;
+    std::chrono::duration<double, std::milli> latency =
+        replay_clock::now() - res->second.sent;
+    latencies[res->second.method].push_back(latency.count());
+    pending.erase(res);
+    if (pending.empty())
+      cv.notify_all();
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::string received;
+  // Requests sent and not answered yet, by id
+  std::map<std::string, request> pending;
+  std::map<std::string, std::vector<double>> latencies;
+};
+
+static void printLatencies(std::map<std::string, std::vector<double>> stats) {
+  std::cout << fmt::format("{:<40} {:>8} {:>9} {:>9} {:>9} {:>9}\n",
+                           "Request (ms)", "count", "p50", "p90", "p99",
+                           "max");
+  for (auto &[method, values] : stats) {
+    std::sort(values.begin(), values.end());
+    auto percentile = [&](double fraction) {
+      size_t i = static_cast<size_t>(fraction * values.size());
+      return values[std::min(i, values.size() - 1)];
+    };
+    std::cout << fmt::format(
+        "{:<40} {:>8} {:>9.2f} {:>9.2f} {:>9.2f} {:>9.2f}\n", method,
+        values.size(), percentile(0.5), percentile(0.9), percentile(0.99),
+        values.back());
+  }
+}
+
+static double getCpuSeconds() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  auto seconds = [](const timeval &tv) { return tv.tv_sec + tv.tv_usec / 1e6; };
+  return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+}
+
+int main(int argc, char *argv[]) {
+  po::options_description desc("Usage: sver-replay [options] transcript\n"
+                               "Allowed options");
+  desc.add_options()("help", "produce help message")(
+      "fast", "send the messages without waiting, instead of at the time "
+              "they were recorded. Transcripts without timing, such as the "
+              "ones of wrapper.sh, are always replayed this way")(
+      "timeout", po::value<unsigned>()->default_value(60),
+      "seconds to wait for the responses before exiting")(
+      "trace", po::value<std::string>(),
+      "write a trace of the requests and compilations to this file");
+  po::options_description hidden;
+  hidden.add_options()("transcript", po::value<std::string>());
+  po::options_description all;
+  all.add(desc).add(hidden);
+  po::positional_options_description positional;
+  positional.add("transcript", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv)
+                .options(all)
+                .positional(positional)
+                .run(),
+            vm);
+  po::notify(vm);
+
+  if (vm.count("help") || !vm.count("transcript")) {
+    std::cout << desc << "\n";
+    return 1;
+  }
+
+  auto path = vm["transcript"].as<std::string>();
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    std::cerr << "Cannot read " << path << std::endl;
+    return 1;
+  }
+  auto messages = readTranscript(file);
+  if (messages.empty()) {
+    std::cerr << "No messages in " << path << std::endl;
+    return 1;
+  }
+  bool fast = vm.count("fast");
+  std::chrono::seconds timeout(vm["timeout"].as<unsigned>());
+  std::string trace_path;
+  if (vm.count("trace"))
+    trace_path = vm["trace"].as<std::string>();
+
+  PipeBuffer input_buffer;
+  ResponseCollector output_buffer;
+  std::istream input(&input_buffer);
+  std::ostream output(&output_buffer);
+  double start_cpu = getCpuSeconds();
+  auto start = replay_clock::now();
+  {
+    StdIOServer server(input, output, trace_path);
+    // The exit stops the server, it waits for the requests sent before
+    std::string exit = R"({"jsonrpc":"2.0","method":"exit"})";
+    for (auto &msg : messages) {
+      if (!fast)
+        std::this_thread::sleep_until(start + msg.time);
+      // The responses of the client to the server are sent untracked
+      rapidjson::Document doc;
+      doc.Parse(msg.content.data(), msg.content.size());
+      if (!doc.HasParseError() && doc.IsObject() && doc.HasMember("method") &&
+          doc["method"].IsString()) {
+        std::string method = doc["method"].GetString();
+        if (method == "exit") {
+          exit = msg.content;
+          break;
+        }
+        if (doc.HasMember("id"))
+          output_buffer.sent(getIdKey(doc["id"]), method);
+      }
+      input_buffer.write(frame(msg.content));
+    }
+    if (!output_buffer.waitAnswers(timeout)) {
+      std::cerr << "Requests not answered:" << std::endl;
+      for (auto &req : output_buffer.getUnanswered())
+        std::cerr << "  " << req << std::endl;
+    }
+    input_buffer.write(frame(exit));
+    server.esc_event.wait();
+
+    std::chrono::duration<double> elapsed = replay_clock::now() - start;
+    std::cout << fmt::format("Replayed {} messages in {:.2f} s, {}\n",
+                             messages.size(), elapsed.count(),
+                             fast ? "as fast as possible"
+                                  : "at the recorded timing");
+    printLatencies(output_buffer.getLatencies());
+    std::cout << "\nServer statistics\n";
+    ServerStats::print(server.getStats(), std::cout);
+    input_buffer.close();
+  }
+
+  auto memory = ServerStats::getMemoryUsage();
+  std::cout << fmt::format("CPU: {:.2f} s, peak RSS: {} MiB\n",
+                           getCpuSeconds() - start_cpu,
+                           memory.peakBytes >> 20);
+  return 0;
+}
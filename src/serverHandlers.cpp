@@ -1,6 +1,7 @@
 #include "serverHandlers.h"
 #include "CompletionHandler.h"
 #include "DiagnosticParser.h"
+#include "DocumentOutline.h"
 #include "LibLsp/lsp/AbsolutePath.h"
 #include "LibLsp/lsp/lsDocumentUri.h"
 #include "LibLsp/lsp/lsp_completion.h"
@@ -9,23 +10,90 @@
 #include "LibLsp/lsp/textDocument/publishDiagnostics.h"
 #include "LibLsp/lsp/workspace/configuration.h"
 #include "NodeVisitor.h"
+#include "RequestDispatcher.h"
 #include "slang/text/SourceLocation.h"
 #include "slang/types/AllTypes.h"
+#include <algorithm>
+#include <cctype>
 #include <filesystem>
 #include <fmt/core.h>
+#include <functional>
 #include <memory>
 #include <optional>
+#include <slang/parsing/LexerFacts.h>
+#include <slang/symbols/ASTVisitor.h>
 #include <slang/syntax/SyntaxTree.h>
 #include <sstream>
 #include <string>
 
-ServerHandlers::ServerHandlers(lsp::Log &log, RemoteEndPoint &remote_end_point)
-    : logger(log), remote(remote_end_point) {
+// Default delays of the analysis tiers, can be changed in the configuration
+static constexpr std::chrono::milliseconds default_syntax_delay{20};
+static constexpr std::chrono::milliseconds default_compile_delay{500};
+// Workspace symbols sent for a query
+static constexpr size_t workspace_symbol_limit = 256;
+// Diagnostics issued between the checks for a newer compilation
+static constexpr size_t diagnostics_per_check = 64;
+
+// True once the client sent $/cancelRequest for the request
+static std::function<bool()> isCancelled(const CancelMonitor &monitor) {
+  return [&monitor]() { return monitor && monitor() != 0; };
+}
+
+// Elaborates a compilation, checking between instances if the result is
+// still wanted. The bodies and expressions bound here are cached in the
+// symbols, so collecting the diagnostics afterwards is quick.
+class Elaborator : public slang::ASTVisitor<Elaborator, true, true> {
+public:
+  explicit Elaborator(std::function<bool()> abandoned)
+      : abandoned(std::move(abandoned)) {}
+
+  template <typename T> void handle(const T &t) {
+    if constexpr (std::is_same_v<slang::InstanceSymbol, T>) {
+      if (stopped || abandoned()) {
+        stopped = true;
+        return;
+      }
+    }
+    if (!stopped)
+      visitDefault(t);
+  }
+
+  bool stopped = false;
+
+private:
+  std::function<bool()> abandoned;
+};
+
+ServerHandlers::ServerHandlers(lsp::Log &log, RemoteEndPoint &remote_end_point,
+                               ServerStats &stats)
+    : logger(log), remote(remote_end_point), stats(stats), snapshot_version(0),
+      sources(stats), compile_on_save(false),
+      completion_limit(CompletionHandler::default_limit),
+      published_generation(0), pull_mode(false),
+      scheduler([this](uint64_t gen) { updateDiagnostics(gen); },
+                default_compile_delay),
+      syntax_scheduler([this](uint64_t gen) { updateSyntaxDiagnostics(gen); },
+                       default_syntax_delay) {
   coptions.lintMode = true;
 
   options.set(coptions);
 }
 
+void ServerHandlers::setClientCapabilities(
+    const ExtraClientCapabilities &capabilities) {
+  auto &text_document = capabilities.textDocument;
+  client.diagnostic_registration =
+      text_document && text_document->diagnostic &&
+      text_document->diagnostic->dynamicRegistration.value_or(false);
+  client.semantic_tokens_registration =
+      text_document && text_document->semanticTokens &&
+      text_document->semanticTokens->dynamicRegistration.value_or(false);
+  auto &workspace = capabilities.workspace;
+  client.diagnostic_refresh =
+      workspace && workspace->diagnostics &&
+      workspace->diagnostics->refreshSupport.value_or(false);
+}
+
 td_initialize::response
 ServerHandlers::initializeHandler(const td_initialize::request &req) {
   td_initialize::response rsp;
@@ -34,6 +102,7 @@ ServerHandlers::initializeHandler(const td_initialize::request &req) {
   auto rootUri = req.params.rootUri;
   if (rootUri.has_value())
     sources.setRootPath(rootUri.value().GetAbsolutePath().path);
+  workspace_symbols.update(sources.getWorkspaceDirectories());
 
   lsCompletionOptions completion_options;
   completion_options.resolveProvider = false;
@@ -48,9 +117,17 @@ ServerHandlers::initializeHandler(const td_initialize::request &req) {
   workspace_folder_options.supported = true;
   workspace_options.workspaceFolders = workspace_folder_options;
 
-  // TODO: Configure  TextDocumentSyncOptions
+  // Receive only the modified ranges of the documents
+  lsTextDocumentSyncOptions sync_options;
+  sync_options.openClose = true;
+  sync_options.change = lsTextDocumentSyncKind::Incremental;
+  lsSaveOptions save_options;
+  save_options.includeText = false;
+  sync_options.save = save_options;
 
   // TODO: Add more capabilities!
+  rsp.result.capabilities.textDocumentSync =
+      std::make_pair(std::nullopt, sync_options);
   rsp.result.capabilities.codeLensProvider = code_lens_options;
   rsp.result.capabilities.completionProvider = completion_options;
   rsp.result.capabilities.renameProvider = std::make_pair(true, std::nullopt);
@@ -58,6 +135,16 @@ ServerHandlers::initializeHandler(const td_initialize::request &req) {
       std::make_pair(true, std::nullopt);
   rsp.result.capabilities.typeDefinitionProvider =
       std::make_pair(true, std::nullopt);
+  rsp.result.capabilities.referencesProvider =
+      std::make_pair(true, std::nullopt);
+  rsp.result.capabilities.workspaceSymbolProvider =
+      std::make_pair(true, std::nullopt);
+  rsp.result.capabilities.documentSymbolProvider =
+      std::make_pair(true, std::nullopt);
+  rsp.result.capabilities.foldingRangeProvider =
+      std::make_pair(true, std::nullopt);
+  rsp.result.capabilities.selectionRangeProvider =
+      std::make_pair(true, std::nullopt);
   // rsp.result.capabilities.workspace = workspace_options;
 
   // Check the client capabilities
@@ -87,139 +174,555 @@ ServerHandlers::initializeHandler(const td_initialize::request &req) {
 void ServerHandlers::didOpenHandler(
     Notify_TextDocumentDidOpen::notify &notify) {
   auto &params = notify.params;
-  // Get full path of the opened file
-  AbsolutePath path = params.textDocument.uri.GetAbsolutePath();
+  FileId file = sources.getFiles().getId(params.textDocument.uri);
 
-  // Create a SourceBuffer from the original file
-  sources.addFile(fs::absolute(path.path));
+  // Load the contents from the editor, the changes are applied on top of them
+  sources.addFile(file, params.textDocument.text);
 
-  updateDiagnostics();
+  // Not an edit, the opened file is compiled even with compileOnSave
+  syntax_scheduler.schedule();
+  scheduler.schedule();
 }
 
 void ServerHandlers::didModifyHandler(
     Notify_TextDocumentDidChange::notify &notify) {
   auto &params = notify.params;
-  AbsolutePath path = params.textDocument.uri.GetAbsolutePath();
+  FileId file = sources.getFiles().getId(params.textDocument.uri);
 
-  // Create a buffer from the new full content
-  int latestChange = params.contentChanges.size() - 1;
-  auto &latestContent = params.contentChanges[latestChange].text;
-  sources.modifyFile(fs::absolute(path.path), latestContent);
+  // Apply the changes to the document, in order
+  sources.modifyFile(file, params.contentChanges);
 
-  updateDiagnostics();
+  scheduleAnalysis();
 }
 
-void ServerHandlers::updateDiagnostics() {
+void ServerHandlers::didSaveHandler(
+    Notify_TextDocumentDidSave::notify &notify) {
+  // The saved file may be a new library file or header
+  sources.rescanLibraries();
+  // Saving is a good moment for the full compilation, don't wait for it
+  scheduler.scheduleNow();
+  workspace_symbols.refreshFile(
+      notify.params.textDocument.uri.GetAbsolutePath().path);
+}
+
+void ServerHandlers::scheduleAnalysis() {
+  // Check the syntax of the edited files right away
+  syntax_scheduler.schedule();
+
+  // The full compilation waits for the editor to be idle, or for a save.
+  // The requests need a first analysis in any case.
+  if (compile_on_save && getSnapshot() != nullptr)
+    scheduler.invalidate();
+  else
+    scheduler.schedule();
+}
+
+void ServerHandlers::publishDiagnostics(
+    const std::map<FileId, std::vector<lsDiagnostic>> &diagnostics,
+    const std::vector<FileId> &files) {
+  // Create the PublishDiagnostics message
+  Notify_TextDocumentPublishDiagnostics::notify pub;
+  auto &pub_params = pub.params;
+
+  std::vector<lsDiagnostic> empty_list;
+  bool changed = false;
+
+  for (auto file : files) {
+    auto res = diagnostics.find(file);
+
+    // Does this file have diagnostics? Otherwise, clear them
+    auto &file_diags = res != diagnostics.end() ? res->second : empty_list;
+
+    // Skip the files whose diagnostics are the same as last time
+    if (!published.update(file, file_diags))
+      continue;
+    changed = true;
+    if (pull_mode)
+      continue;
+
+    // Send the diagnostics to the client
+    pub_params.uri.SetPath(
+        AbsolutePath(sources.getFiles().getPath(file).string()));
+    pub_params.diagnostics = file_diags;
+    remote.send(pub);
+  }
+
+  // Pulling clients ask again for the diagnostics when told to, the others
+  // only ask for the files they edit
+  if (pull_mode && changed && client.diagnostic_refresh) {
+    wp_diagnosticRefresh::request refresh;
+    remote.send(refresh);
+  }
+}
+
+void ServerHandlers::updateSyntaxDiagnostics(uint64_t generation) {
+  TraceWriter::setThreadName("syntax check");
+  ServerStats::scoped_phase phase(stats, ServerStats::phase_syntax_check);
+  auto stale = [&]() { return syntax_scheduler.isStale(generation); };
+  // Edits seen by this check, to compare it with the full compilations
+  uint64_t full_generation = scheduler.getGeneration();
+
+  // Reparse only the edited files, they go to the cache for the full
+  // compilation anyway
+  std::shared_ptr<slang::SourceManager> sm;
+  auto trees = sources.parseChangedFiles(sm, stale);
+  if (trees.empty())
+    return;
+
+  slang::DiagnosticEngine engine(*sm);
+  engine.setDefaultWarnings();
+  auto parser = std::make_shared<DiagnosticParser>(logger, sources);
+  engine.addClient(parser);
+
+  std::vector<FileId> files;
+  {
+    ServerStats::scoped_phase phase(stats, ServerStats::phase_format);
+    for (auto &[file, tree] : trees) {
+      if (stale())
+        return;
+      files.push_back(file);
+      for (auto &diag : tree->diagnostics())
+        engine.issue(diag);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(publish_mutex);
+  // Don't replace the results of a full compilation of the same contents
+  if (published_generation >= full_generation)
+    return;
+  ServerStats::scoped_phase phase(stats, ServerStats::phase_publish);
+  publishDiagnostics(parser->getDiagnostics(), files);
+}
+
+void ServerHandlers::updateDiagnostics(uint64_t generation) {
+  TraceWriter::setThreadName("compile");
+  ServerStats::scoped_phase compile_phase(stats, ServerStats::phase_compile);
+  auto stale = [&]() { return scheduler.isStale(generation); };
+
   // Recompile the design
-  std::shared_ptr<slang::Compilation> compilation = sources.compile();
-  std::shared_ptr<slang::SourceManager> sm = sources.getSourceManager();
+  std::shared_ptr<slang::SourceManager> sm;
+  std::shared_ptr<slang::Compilation> compilation =
+      sources.compile(sm, stale);
+  if (compilation == nullptr)
+    return;
+  // Elaboration takes long, newer changes may arrive meanwhile
+  Elaborator elaborator(stale);
+  {
+    ServerStats::scoped_phase phase(stats, ServerStats::phase_elaboration);
+    compilation->getRoot().visit(elaborator);
+  }
+  if (elaborator.stopped)
+    return;
 
   // Recreate diagnostic tree
   slang::DiagnosticEngine engine(*sm);
   engine.setDefaultWarnings();
-  auto parser = std::make_shared<DiagnosticParser>(logger);
+  auto parser = std::make_shared<DiagnosticParser>(logger, sources);
   engine.addClient(parser);
 
   // Clear the previous diagnostics list
   parser->clearDiagnostics();
 
   // Get diagnostics and feed them to the parser
+  auto start = ServerStats::clock::now();
   auto &diags = compilation->getAllDiagnostics();
-  for (auto &diag : diags) {
-    engine.issue(diag);
+  stats.addPhase(ServerStats::phase_diagnostics, start);
+  if (stale())
+    return;
+  {
+    ServerStats::scoped_phase phase(stats, ServerStats::phase_format);
+    for (size_t i = 0; i < diags.size(); i++) {
+      if (i % diagnostics_per_check == 0 && stale())
+        return;
+      engine.issue(diags[i]);
+    }
   }
 
-  // Create the PublishDiagnostics message
-  Notify_TextDocumentPublishDiagnostics::notify pub;
-  auto &pub_params = pub.params;
-
-  std::vector<lsDiagnostic> empty_list;
-  auto &diagnostics = parser->getDiagnostics();
-
-  // Iterate all the known open files
-  for (auto &filename : sources.getUserFiles()) {
-    pub_params.uri.SetPath(AbsolutePath(filename));
-    auto res = diagnostics.find(filename);
-
-    // Does this file have diagnostics? Add them to the message
-    if (res != diagnostics.end()) {
-      pub_params.diagnostics = res->second;
-    } else {
-      // Otherwise, clear the diagnostics for the file
-      pub_params.diagnostics = empty_list;
-    }
-    // Send the diagnostics to the client
-    remote.send(pub);
+  {
+    // The full results replace the syntax-only ones of all the open files
+    std::lock_guard<std::mutex> lock(publish_mutex);
+    ServerStats::scoped_phase phase(stats, ServerStats::phase_publish);
+    published_generation = generation;
+    publishDiagnostics(parser->getDiagnostics(), sources.getUserFiles());
   }
 
-  std::shared_ptr<NodeVisitor> new_visitor = std::make_shared<NodeVisitor>(sm);
-  // Load the symbols from the compiled tree
-  compilation->getRoot().visit(*new_visitor);
+  std::shared_ptr<NodeVisitor> new_visitor;
+  std::shared_ptr<CompletionCatalog> new_catalog;
+  {
+    ServerStats::scoped_phase phase(stats, ServerStats::phase_indexing);
+    new_visitor = std::make_shared<NodeVisitor>(sm, sources.getFiles(), stale);
+    // Load the symbols from the compiled tree
+    compilation->getRoot().visit(*new_visitor);
+    if (stale())
+      return;
+    new_visitor->finish();
+    // Completion items of the open files, ready to be filtered
+    new_catalog = std::make_shared<CompletionCatalog>(*new_visitor,
+                                                      sources.getUserFiles());
+  }
+  // Names and their declarations, for the navigation requests. Only the
+  // files changed since the last one, and their users, are indexed again.
+  auto previous = getSnapshot();
+  std::shared_ptr<ReferenceIndex> new_references;
+  {
+    ServerStats::scoped_phase phase(stats, ServerStats::phase_references);
+    SourcePositions positions(sources);
+    new_references = std::make_shared<ReferenceIndex>(
+        *compilation, *sm, positions, sources.getCompiledTrees(),
+        previous ? previous->references.get() : nullptr, stale);
+  }
+  if (stale())
+    return;
+
+  // Publish the new analysis, readers holding the old one keep it alive
+  auto new_snapshot = std::make_shared<AnalysisSnapshot>();
+  new_snapshot->version = ++snapshot_version;
+  new_snapshot->sm = sm;
+  new_snapshot->compilation = compilation;
+  new_snapshot->nv = new_visitor;
+  new_snapshot->catalog = new_catalog;
+  new_snapshot->references = new_references;
+  new_snapshot->revisions = sources.getCompiledRevisions();
+  std::atomic_store(&snapshot,
+                    std::shared_ptr<const AnalysisSnapshot>(new_snapshot));
+}
 
-  if (nv == nullptr)
-    nv = new_visitor;
-  else
-    nv.swap(new_visitor);
+std::shared_ptr<const AnalysisSnapshot> ServerHandlers::getSnapshot() const {
+  return std::atomic_load(&snapshot);
 }
 
 td_completion::response
-ServerHandlers::completionHandler(const td_completion::request &req) {
+ServerHandlers::completionHandler(const td_completion::request &req,
+                                  const CancelMonitor &monitor) {
   td_completion::response resp;
 
-  auto fname = req.params.textDocument.uri.GetAbsolutePath().path;
+  FileId file = sources.getFiles().getId(req.params.textDocument.uri);
   auto lineno = req.params.position.line;
   auto colno = req.params.position.character;
-  CompletionHandler completer(nv);
-
-  std::string line;
-  std::string contents(sources.getFileContents(fname));
-  std::istringstream in(contents);
-
-  if (!contents.empty()) {
-    // We have the file's contents, lets get the line we want
-    line.reserve(256);
-    bool valid_line = true;
-    int i = 0;
-    while (i <= lineno && std::getline(in, line)) {
-      i++;
+  auto current = getSnapshot();
+  CompletionHandler completer(current ? current->nv : nullptr,
+                              current ? current->catalog : nullptr,
+                              completion_limit, isCancelled(monitor));
+
+  // Get the line we want from the file's contents
+  std::string line = sources.getFileLine(file, lineno);
+
+  if (!line.empty()) {
+    // The column is in UTF-16 units
+    auto column = LineIndex::utf16Offset(line, colno);
+    auto position = NodeVisitor::makePosition(lineno, column);
+    line = line.substr(0, column);
+    auto start = line.find_last_of(" \t\f\v+-*/&|^?@!~(");
+    if (start != std::string::npos) {
+      line = line.substr(start + 1);
     }
-    if (i - 1 == lineno) {
-      if (colno <= line.length()) {
-        line = line.substr(0, colno);
-      }
-      auto start = line.find_last_of(" \t\f\v+-*/&|^?@!~(");
-      if (start != std::string::npos) {
-        line = line.substr(start + 1);
-      }
 
-      // Get rid of completed array slices
-      int arrayStart, array_b, array_e;
-      array_b = 0;
-      array_e = 0;
-      for (char c : line) {
-        if (c == '[')
-          array_b++;
-        else if (c == ']') {
-          if (array_b > array_e)
-            array_e++;
-          else
-            return resp; // Badly formatted line
-        }
-        if (!(array_b || array_e))
-          arrayStart++;
+    // Get rid of completed array slices
+    int arrayStart, array_b, array_e;
+    array_b = 0;
+    array_e = 0;
+    for (char c : line) {
+      if (c == '[')
+        array_b++;
+      else if (c == ']') {
+        if (array_b > array_e)
+          array_e++;
+        else
+          return resp; // Badly formatted line
       }
+      if (!(array_b || array_e))
+        arrayStart++;
+    }
 
-      int arrayLevels = 0;
-      if (array_b > array_e) {
-        // Writing inside array index, cut previous part
-        start = line.find_last_of('[');
-        line = line.substr(start + 1);
-      } else
-        arrayLevels = array_b;
+    int arrayLevels = 0;
+    if (array_b > array_e) {
+      // Writing inside array index, cut previous part
+      start = line.find_last_of('[');
+      line = line.substr(start + 1);
+    } else
+      arrayLevels = array_b;
 
-      // Run the completion
-      completer.complete(line, fname, resp, arrayLevels);
+    // Run the completion
+    completer.complete(line, file, position, resp, arrayLevels);
+  }
+  return resp;
+}
+
+lsLocation ServerHandlers::getLocation(const ReferenceIndex::location &loc) {
+  lsLocation res;
+  res.uri.SetPath(AbsolutePath(sources.getFiles().getPath(loc.file).string()));
+  res.range = loc.range;
+  return res;
+}
+
+td_definition::response
+ServerHandlers::definitionHandler(const td_definition::request &req) {
+  td_definition::response rsp;
+  rsp.id = req.id;
+  rsp.result.first = std::vector<lsLocation>();
+
+  auto current = getSnapshot();
+  if (current == nullptr || current->references == nullptr)
+    return rsp;
+  FileId file = sources.getFiles().getId(req.params.textDocument.uri);
+  auto decl = current->references->findDefinition(file, req.params.position);
+  if (decl)
+    rsp.result.first->push_back(getLocation(*decl));
+  return rsp;
+}
+
+td_typeDefinition::response
+ServerHandlers::typeDefinitionHandler(const td_typeDefinition::request &req) {
+  td_typeDefinition::response rsp;
+  rsp.id = req.id;
+  rsp.result.first = std::vector<lsLocation>();
+
+  auto current = getSnapshot();
+  if (current == nullptr || current->references == nullptr)
+    return rsp;
+  FileId file = sources.getFiles().getId(req.params.textDocument.uri);
+  auto decl =
+      current->references->findTypeDefinition(file, req.params.position);
+  if (decl)
+    rsp.result.first->push_back(getLocation(*decl));
+  return rsp;
+}
+
+td_references::response
+ServerHandlers::referencesHandler(const td_references::request &req,
+                                  const CancelMonitor &monitor) {
+  td_references::response rsp;
+  rsp.id = req.id;
+
+  auto current = getSnapshot();
+  if (current == nullptr || current->references == nullptr)
+    return rsp;
+  FileId file = sources.getFiles().getId(req.params.textDocument.uri);
+  for (auto &loc : current->references->findReferences(
+           file, req.params.position, req.params.context.includeDeclaration,
+           isCancelled(monitor)))
+    rsp.result.push_back(getLocation(loc));
+  return rsp;
+}
+
+// Simple identifiers only, escaped ones would need the spaces kept
+static bool isIdentifier(const std::string &name) {
+  auto start = [](unsigned char c) { return std::isalpha(c) || c == '_'; };
+  if (name.empty() || !start(name[0]))
+    return false;
+  if (!std::all_of(name.begin(), name.end(), [](unsigned char c) {
+        return std::isalnum(c) || c == '_' || c == '$';
+      }))
+    return false;
+  auto keywords =
+      slang::LexerFacts::getKeywordTable(slang::KeywordVersion::v1800_2017);
+  return keywords->find(name) == keywords->end();
+}
+
+td_rename::response
+ServerHandlers::renameHandler(const td_rename::request &req) {
+  td_rename::response rsp;
+  rsp.id = req.id;
+
+  auto &name = req.params.newName;
+  if (!isIdentifier(name))
+    throw RequestError(lsErrorCodes::InvalidParams,
+                       fmt::format("'{}' is not a valid identifier", name));
+  auto current = getSnapshot();
+  if (current == nullptr || current->references == nullptr)
+    return rsp;
+  FileId file = sources.getFiles().getId(req.params.textDocument.uri);
+  auto locations =
+      current->references->findReferences(file, req.params.position, true);
+
+  // The ranges are those of the compiled text, edits made since would move
+  // them
+  auto stale = [&](FileId changed) {
+    auto res = current->revisions.find(changed);
+    uint64_t compiled = res != current->revisions.end() ? res->second : 0;
+    return sources.getRevision(changed) != compiled;
+  };
+  bool outdated = stale(file);
+  for (auto &loc : locations)
+    outdated = outdated || stale(loc.file);
+  if (outdated)
+    throw RequestError(lsErrorCodes::InvalidRequest,
+                       "The files changed since the last analysis, rename "
+                       "again once it is updated");
+
+  std::map<std::string, std::vector<lsTextEdit>> changes;
+  for (auto &loc : locations) {
+    auto lsp_loc = getLocation(loc);
+    lsTextEdit edit;
+    edit.range = lsp_loc.range;
+    edit.newText = name;
+    changes[lsp_loc.uri.raw_uri_].push_back(edit);
+  }
+  rsp.result.changes = std::move(changes);
+  return rsp;
+}
+
+wp_symbol::response
+ServerHandlers::workspaceSymbolHandler(const wp_symbol::request &req,
+                                       const CancelMonitor &monitor) {
+  wp_symbol::response rsp;
+  rsp.id = req.id;
+  rsp.result = workspace_symbols.find(req.params.query, workspace_symbol_limit,
+                                      isCancelled(monitor));
+  return rsp;
+}
+
+// The structure of a file only needs its syntax, so these work before the
+// first compilation and on files it does not reach
+
+td_symbol::response
+ServerHandlers::documentSymbolHandler(const td_symbol::request &req) {
+  td_symbol::response rsp;
+  rsp.id = req.id;
+  FileId file = sources.getFiles().getId(req.params.textDocument.uri);
+  auto parsed = sources.getSyntaxTree(file);
+  if (parsed.tree == nullptr)
+    return rsp;
+  DocumentOutline outline(*parsed.tree, *parsed.sm, *parsed.lines);
+  rsp.result = outline.getSymbols();
+  return rsp;
+}
+
+td_foldingRange::response
+ServerHandlers::foldingRangeHandler(const td_foldingRange::request &req) {
+  td_foldingRange::response rsp;
+  rsp.id = req.id;
+  FileId file = sources.getFiles().getId(req.params.textDocument.uri);
+  auto parsed = sources.getSyntaxTree(file);
+  if (parsed.tree == nullptr)
+    return rsp;
+  DocumentOutline outline(*parsed.tree, *parsed.sm, *parsed.lines);
+  rsp.result = outline.getFoldingRanges();
+  return rsp;
+}
+
+td_syntaxSelectionRange::response ServerHandlers::selectionRangeHandler(
+    const td_syntaxSelectionRange::request &req) {
+  td_syntaxSelectionRange::response rsp;
+  rsp.id = req.id;
+  FileId file = sources.getFiles().getId(req.params.textDocument.uri);
+  auto parsed = sources.getSyntaxTree(file);
+  std::optional<DocumentOutline> outline;
+  if (parsed.tree != nullptr)
+    outline.emplace(*parsed.tree, *parsed.sm, *parsed.lines);
+
+  // One result per position, at least the empty range at the position
+  for (auto &position : req.params.positions) {
+    SyntaxSelectionRange res;
+    if (outline)
+      res.ranges = outline->getSelectionRanges(position);
+    if (res.ranges.empty()) {
+      lsRange empty;
+      empty.start = position;
+      empty.end = position;
+      res.ranges.push_back(empty);
     }
+    rsp.result.push_back(std::move(res));
+  }
+  return rsp;
+}
+
+std::vector<uint32_t>
+ServerHandlers::getSemanticTokens(FileId file,
+                                  const std::optional<lsRange> &range) {
+  auto parsed = sources.getSyntaxTree(file);
+  if (parsed.tree == nullptr)
+    return {};
+  // The symbols of the last compilation, if any, classify the other names
+  auto current = getSnapshot();
+  const NodeVisitor *nv = current != nullptr ? current->nv.get() : nullptr;
+  SemanticTokens tokens(*parsed.tree, *parsed.lines, nv, file, range);
+  return tokens.encode();
+}
+
+td_semanticTokensFull::response ServerHandlers::semanticTokensHandler(
+    const td_semanticTokensFull::request &req) {
+  td_semanticTokensFull::response rsp;
+  rsp.id = req.id;
+  FileId file = sources.getFiles().getId(req.params.textDocument.uri);
+  rsp.result.data = getSemanticTokens(file, std::nullopt);
+  rsp.result.resultId = semantic_tokens.update(file, rsp.result.data);
+  return rsp;
+}
+
+// Only the visible lines, the result is not the base of the deltas
+td_semanticTokensRange::response ServerHandlers::semanticTokensRangeHandler(
+    const td_semanticTokensRange::request &req) {
+  td_semanticTokensRange::response rsp;
+  rsp.id = req.id;
+  FileId file = sources.getFiles().getId(req.params.textDocument.uri);
+  rsp.result.data = getSemanticTokens(file, req.params.range);
+  return rsp;
+}
+
+td_semanticTokensDelta::response ServerHandlers::semanticTokensDeltaHandler(
+    const td_semanticTokensDelta::request &req) {
+  td_semanticTokensDelta::response rsp;
+  rsp.id = req.id;
+  FileId file = sources.getFiles().getId(req.params.textDocument.uri);
+  auto data = getSemanticTokens(file, std::nullopt);
+  auto edits = semantic_tokens.diff(file, req.params.previousResultId, data);
+  rsp.result.resultId = semantic_tokens.update(file, data);
+  if (edits)
+    rsp.result.edits = std::move(*edits);
+  else
+    rsp.result.data = std::move(data);
+  return rsp;
+}
+
+void ServerHandlers::initializedHandler() {
+  // Offer pull diagnostics, clients that use them stop getting the pushed ones
+  if (client.diagnostic_registration) {
+    client_registerDiagnostics::request reg;
+    DiagnosticRegistration registration;
+    registration.id = "sver-diagnostics";
+    registration.method = td_diagnostic::request::kMethodInfo;
+    registration.registerOptions.interFileDependencies = true;
+    registration.registerOptions.workspaceDiagnostics = false;
+    reg.params.registrations.push_back(registration);
+    remote.send(reg);
+    // Decided before the first push, pushed diagnostics would never be
+    // cleared by the pulled ones
+    pull_mode = true;
+  }
+
+  // Like the pull diagnostics, the tokens can't be advertised statically
+  if (client.semantic_tokens_registration) {
+    client_registerSemanticTokens::request tokens_reg;
+    SemanticTokenRegistration tokens_registration;
+    tokens_registration.id = "sver-semantic-tokens";
+    tokens_registration.method = "textDocument/semanticTokens";
+    tokens_registration.registerOptions.legend = SemanticTokens::getLegend();
+    tokens_registration.registerOptions.range = true;
+    tokens_registration.registerOptions.full.delta = true;
+    tokens_reg.params.registrations.push_back(tokens_registration);
+    remote.send(tokens_reg);
+  }
+}
+
+td_diagnostic::response
+ServerHandlers::diagnosticHandler(const td_diagnostic::request &req) {
+  td_diagnostic::response resp;
+  resp.id = req.id;
+
+  FileId file = sources.getFiles().getId(req.params.textDocument.uri);
+  std::vector<lsDiagnostic> diagnostics;
+  std::string result_id;
+  published.get(file, diagnostics, result_id);
+
+  resp.result.resultId = result_id;
+  if (req.params.previousResultId.has_value() &&
+      req.params.previousResultId.value() == result_id) {
+    // The client already has these
+    resp.result.kind = "unchanged";
+  } else {
+    resp.result.kind = "full";
+    resp.result.items = std::move(diagnostics);
   }
   return resp;
 }
@@ -229,4 +732,17 @@ void ServerHandlers::configChange(
   ServerConfigTop config;
   notify.params.settings.GetFromMap(config);
   sources.setConfig(config.verilog);
+  workspace_symbols.update(sources.getWorkspaceDirectories());
+  if (config.verilog.syntaxDelay.has_value())
+    syntax_scheduler.setDelay(
+        std::chrono::milliseconds(config.verilog.syntaxDelay.value()));
+  if (config.verilog.compileDelay.has_value())
+    scheduler.setDelay(
+        std::chrono::milliseconds(config.verilog.compileDelay.value()));
+  if (config.verilog.compileOnSave.has_value())
+    compile_on_save = config.verilog.compileOnSave.value();
+  if (config.verilog.completionLimit.has_value())
+    completion_limit = std::max(1, config.verilog.completionLimit.value());
+
+  scheduler.schedule();
 }
@@ -1,16 +1,32 @@
+#include "AnalysisSnapshot.h"
+#include "CompileScheduler.h"
 #include "DiagnosticParser.h"
+#include "DiagnosticStore.h"
 #include "LibLsp/JsonRpc/MessageIssue.h"
 #include "LibLsp/JsonRpc/RemoteEndPoint.h"
 #include "LibLsp/lsp/general/initialize.h"
 #include "LibLsp/lsp/lsAny.h"
 #include "LibLsp/lsp/textDocument/completion.h"
+#include "LibLsp/lsp/textDocument/declaration_definition.h"
 #include "LibLsp/lsp/textDocument/did_change.h"
 #include "LibLsp/lsp/textDocument/did_open.h"
+#include "LibLsp/lsp/textDocument/did_save.h"
+#include "LibLsp/lsp/textDocument/document_symbol.h"
+#include "LibLsp/lsp/textDocument/foldingRange.h"
+#include "LibLsp/lsp/textDocument/references.h"
+#include "LibLsp/lsp/textDocument/rename.h"
+#include "LibLsp/lsp/textDocument/type_definition.h"
 #include "LibLsp/lsp/workspace/did_change_configuration.h"
+#include "LibLsp/lsp/workspace/symbol.h"
+#include "LspExtensions.h"
 #include "NodeVisitor.h"
 #include "ProjectSources.h"
+#include "SemanticTokens.h"
 #include "ServerConfig.h"
+#include "ServerStats.h"
+#include "WorkspaceSymbols.h"
 #include <array>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <slang/compilation/Compilation.h>
@@ -21,20 +37,85 @@
 class ServerHandlers {
 
 public:
-  ServerHandlers(lsp::Log &log, RemoteEndPoint &remote_end_point);
+  ServerHandlers(lsp::Log &log, RemoteEndPoint &remote_end_point,
+                 ServerStats &stats);
   td_initialize::response initializeHandler(const td_initialize::request &req);
-  td_completion::response completionHandler(const td_completion::request &req);
+  // Capabilities of the client missing from the initialize request of LspCpp
+  void setClientCapabilities(const ExtraClientCapabilities &capabilities);
+  // The requests that can take long stop once the client cancels them
+  td_completion::response completionHandler(const td_completion::request &req,
+                                            const CancelMonitor &monitor);
+  td_definition::response definitionHandler(const td_definition::request &req);
+  td_typeDefinition::response
+  typeDefinitionHandler(const td_typeDefinition::request &req);
+  td_references::response referencesHandler(const td_references::request &req,
+                                            const CancelMonitor &monitor);
+  td_rename::response renameHandler(const td_rename::request &req);
+  wp_symbol::response workspaceSymbolHandler(const wp_symbol::request &req,
+                                             const CancelMonitor &monitor);
+  td_symbol::response documentSymbolHandler(const td_symbol::request &req);
+  td_foldingRange::response
+  foldingRangeHandler(const td_foldingRange::request &req);
+  td_syntaxSelectionRange::response
+  selectionRangeHandler(const td_syntaxSelectionRange::request &req);
+  td_semanticTokensFull::response
+  semanticTokensHandler(const td_semanticTokensFull::request &req);
+  td_semanticTokensRange::response
+  semanticTokensRangeHandler(const td_semanticTokensRange::request &req);
+  td_semanticTokensDelta::response
+  semanticTokensDeltaHandler(const td_semanticTokensDelta::request &req);
   void didOpenHandler(Notify_TextDocumentDidOpen::notify &notify);
   void didModifyHandler(Notify_TextDocumentDidChange::notify &notify);
+  void didSaveHandler(Notify_TextDocumentDidSave::notify &notify);
   void configChange(Notify_WorkspaceDidChangeConfiguration::notify &notify);
-  void updateDiagnostics();
+  void initializedHandler();
+  td_diagnostic::response diagnosticHandler(const td_diagnostic::request &req);
+  void updateDiagnostics(uint64_t generation);
+  void updateSyntaxDiagnostics(uint64_t generation);
+  // Get the latest published analysis, nullptr if there is none yet
+  std::shared_ptr<const AnalysisSnapshot> getSnapshot() const;
 
 private:
+  void scheduleAnalysis();
+  lsLocation getLocation(const ReferenceIndex::location &loc);
+  // Encoded semantic tokens of the current text of a file
+  std::vector<uint32_t>
+  getSemanticTokens(FileId file, const std::optional<lsRange> &range);
+  void publishDiagnostics(
+      const std::map<FileId, std::vector<lsDiagnostic>> &diagnostics,
+      const std::vector<FileId> &files);
+
   lsp::Log &logger;
   RemoteEndPoint &remote;
+  ServerStats &stats;
   slang::CompilationOptions coptions;
   slang::Bag options;
-  std::shared_ptr<NodeVisitor> nv;
+  // Only accessed through std::atomic_load/atomic_store
+  std::shared_ptr<const AnalysisSnapshot> snapshot;
+  uint64_t snapshot_version;
   ProjectSources sources;
-  std::mutex visitor_mutex, compile_mutex;
+  bool compile_on_save;
+  // Set by the configuration while the lanes read it
+  std::atomic<size_t> completion_limit;
+  // Generation of the last published full compilation
+  std::mutex publish_mutex;
+  uint64_t published_generation;
+  // Last diagnostics of each file, only the changes are sent
+  DiagnosticStore published;
+  // Last semantic tokens of each file, the deltas are computed from them
+  SemanticTokenStore semantic_tokens;
+  // What the client supports, set while initializing, before any compilation
+  struct client_capabilities {
+    bool diagnostic_registration = false;
+    bool diagnostic_refresh = false;
+    bool semantic_tokens_registration = false;
+  } client;
+  // Set when the client registers the pull diagnostics, then they are never
+  // pushed
+  std::atomic<bool> pull_mode;
+  // Declarations of all the sources in the workspace, even if not compiled
+  WorkspaceSymbols workspace_symbols;
+  // Declared last: their threads must stop before the rest is destroyed
+  CompileScheduler scheduler;
+  CompileScheduler syntax_scheduler;
 };